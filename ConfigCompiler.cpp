@@ -0,0 +1,33 @@
+// Compiles a `key = value` configuration file into a config image that
+// ConfigImage maps without parsing.
+//
+// Build: g++ -std=c++20 -O2 ConfigCompiler.cpp -o ConfigCompiler
+// Run:   ./ConfigCompiler settings.conf settings.cfg
+#include "ConfigImage.h"
+#include "ConfigTable.h"
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+
+int main(int argc, char** argv) {
+    if (3 != argc) {
+        fprintf(stderr, "usage: %s input.conf output.cfg\n", argv[0]);
+        return 2;
+    }
+    try {
+        std::ifstream in{argv[1]};
+        if (!in) {
+            throw std::runtime_error{std::string{"cannot open "} + argv[1]};
+        }
+        auto settings = ConfigTable::readSettings(in, argv[1]);
+        const auto lines = settings.size();
+        ConfigImage::compile(std::move(settings), argv[2]);
+        const ConfigImage image{argv[2]};
+        printf("%s: %zu settings, %zu keys\n", argv[2], lines, image.size());
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
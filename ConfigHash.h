@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// The key hash shared by ConfigTable and the ConfigImage file format:
+// FNV-1a, then the MurmurHash3 finalizer to spread it over all bits.
+// Compiled images store slots chosen by it, so changing it changes the
+// format.
+inline uint64_t configMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t configHash(std::string_view key) {
+    uint64_t h = 0xcbf29ce484222325;
+    for (const auto c : key) {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    return configMix(h);
+}
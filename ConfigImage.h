@@ -0,0 +1,357 @@
+#pragma once
+
+#include "ConfigHash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A configuration compiled ahead of time (see ConfigCompiler.cpp) into a
+// file that is mapped and queried in place: opening it is an mmap() and a
+// header check, with nothing parsed, hashed or copied.
+//
+// Layout, all integers in host byte order:
+//     ConfigImageHeader
+//     ConfigImageEntry[count], sorted by key
+//     ConfigImageSlot[indexSize], a hash index over the entries
+//     string pool holding every key and value
+// The index is open addressing with linear probing at most half full,
+// keyed by configHash() (see ConfigHash.h). Each slot keeps 32 bits of its
+// key's hash, so a lookup touches the pool only for the key that matches.
+
+struct ConfigImageHeader {
+    static constexpr uint64_t kMagic = 0x6366672d696d6167; // "cfg-imag"
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint64_t entriesOffset;
+    // A power of two.
+    uint64_t indexSize;
+    uint64_t indexOffset;
+    uint64_t poolOffset;
+    uint64_t poolSize;
+};
+
+struct ConfigImageEntry {
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    uint32_t valueOffset;
+    uint32_t valueLength;
+};
+
+struct ConfigImageSlot {
+    uint32_t tag;
+    // Index of the entry plus one; 0 marks an empty slot.
+    uint32_t entry;
+};
+
+class ConfigImage {
+public:
+    // Throws std::system_error if the file cannot be mapped and
+    // std::runtime_error if it is not a config image.
+    explicit ConfigImage(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "open " + path};
+        }
+        struct stat st {};
+        if (0 != fstat(fd, &st)) {
+            const auto error = errno;
+            close(fd);
+            throw std::system_error{error, std::generic_category(),
+                                    "fstat " + path};
+        }
+        _size = static_cast<size_t>(st.st_size);
+        if (_size < sizeof(ConfigImageHeader)) {
+            close(fd);
+            throw std::runtime_error{path + " is not a config image"};
+        }
+        _base = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        const auto error = errno;
+        close(fd);
+        if (MAP_FAILED == _base) {
+            throw std::system_error{error, std::generic_category(),
+                                    "mmap " + path};
+        }
+        const auto& header = *static_cast<const ConfigImageHeader*>(_base);
+        if (!fits(header)) {
+            munmap(_base, _size);
+            throw std::runtime_error{path + " is not a config image"};
+        }
+        const auto* bytes = static_cast<const char*>(_base);
+        _entries = reinterpret_cast<const ConfigImageEntry*>(
+            bytes + header.entriesOffset);
+        _count = header.count;
+        _index = reinterpret_cast<const ConfigImageSlot*>(
+            bytes + header.indexOffset);
+        _mask = header.indexSize - 1;
+        _pool = {bytes + header.poolOffset, header.poolSize};
+    }
+
+    ConfigImage(ConfigImage&& other) noexcept
+        : _base{std::exchange(other._base, nullptr)},
+          _size{std::exchange(other._size, 0)},
+          _entries{other._entries},
+          _count{std::exchange(other._count, 0)},
+          _index{other._index},
+          _mask{other._mask},
+          _pool{other._pool} {}
+
+    ConfigImage& operator=(ConfigImage&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            _base = std::exchange(other._base, nullptr);
+            _size = std::exchange(other._size, 0);
+            _entries = other._entries;
+            _count = std::exchange(other._count, 0);
+            _index = other._index;
+            _mask = other._mask;
+            _pool = other._pool;
+        }
+        return *this;
+    }
+
+    ~ConfigImage() { unmap(); }
+
+    size_t size() const { return _count; }
+
+    // The views point into the mapping and live as long as this image.
+    std::optional<std::string_view> find(std::string_view key) const {
+        if (0u == _count) {
+            return std::nullopt;
+        }
+        const auto h = hash(key);
+        const auto tag = static_cast<uint32_t>(h >> 32);
+        // The index is never full, but a damaged one might be.
+        for (auto i = h & _mask, probes = _mask + 1; 0u != probes;
+             i = (i + 1) & _mask, --probes) {
+            const auto slot = _index[i];
+            if (0u == slot.entry || slot.entry > _count) {
+                return std::nullopt;
+            }
+            const auto& entry = _entries[slot.entry - 1];
+            if (slot.tag == tag && keyOf(entry) == key) {
+                return text(entry.valueOffset, entry.valueLength);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // The keys in sorted order.
+    std::string_view keyAt(size_t i) const { return keyOf(_entries[i]); }
+    std::string_view valueAt(size_t i) const {
+        return text(_entries[i].valueOffset, _entries[i].valueLength);
+    }
+
+    // Writes the settings as an image to path + ".tmp", flushes it to disk
+    // and renames it over path, so a crash leaves the old image or the new
+    // one. On failure the temporary file is removed. Later duplicates of a
+    // key replace earlier ones.
+    static void compile(
+        std::vector<std::pair<std::string, std::string>> settings,
+        const std::string& path) {
+        std::stable_sort(settings.begin(), settings.end(),
+                         [](const auto& a, const auto& b) {
+                             return a.first < b.first;
+                         });
+        // Keep the last of every run of equal keys.
+        std::vector<std::pair<std::string, std::string>> unique;
+        unique.reserve(settings.size());
+        for (auto& setting : settings) {
+            if (!unique.empty() && unique.back().first == setting.first) {
+                unique.back() = std::move(setting);
+            } else {
+                unique.push_back(std::move(setting));
+            }
+        }
+        if (unique.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error{"config image: too many keys"};
+        }
+
+        std::vector<ConfigImageEntry> entries;
+        entries.reserve(unique.size());
+        uint64_t indexSize = 2;
+        while (indexSize < 2 * unique.size()) {
+            indexSize *= 2;
+        }
+        std::vector<ConfigImageSlot> index(indexSize);
+        std::string pool;
+        const auto append = [&](const std::string& s) {
+            if (pool.size() + s.size() > std::numeric_limits<uint32_t>::max()) {
+                throw std::length_error{"config image: string pool over 4 GiB"};
+            }
+            const auto offset = static_cast<uint32_t>(pool.size());
+            pool += s;
+            return offset;
+        };
+        for (const auto& [key, value] : unique) {
+            const auto h = hash(key);
+            auto i = h & (indexSize - 1);
+            while (0u != index[i].entry) {
+                i = (i + 1) & (indexSize - 1);
+            }
+            index[i] = {static_cast<uint32_t>(h >> 32),
+                        static_cast<uint32_t>(entries.size() + 1)};
+            ConfigImageEntry entry{};
+            entry.keyOffset = append(key);
+            entry.keyLength = static_cast<uint32_t>(key.size());
+            entry.valueOffset = append(value);
+            entry.valueLength = static_cast<uint32_t>(value.size());
+            entries.push_back(entry);
+        }
+
+        ConfigImageHeader header{};
+        header.magic = ConfigImageHeader::kMagic;
+        header.version = ConfigImageHeader::kVersion;
+        header.count = static_cast<uint32_t>(entries.size());
+        header.entriesOffset = sizeof(header);
+        header.indexSize = indexSize;
+        header.indexOffset =
+            header.entriesOffset + entries.size() * sizeof(ConfigImageEntry);
+        header.poolOffset =
+            header.indexOffset + index.size() * sizeof(ConfigImageSlot);
+        header.poolSize = pool.size();
+
+        const auto tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "open " + tmp};
+        }
+        try {
+            writeAll(fd, &header, sizeof(header), tmp);
+            writeAll(fd, entries.data(),
+                     entries.size() * sizeof(ConfigImageEntry), tmp);
+            writeAll(fd, index.data(), index.size() * sizeof(ConfigImageSlot),
+                     tmp);
+            writeAll(fd, pool.data(), pool.size(), tmp);
+            if (0 != fsync(fd)) {
+                throw std::system_error{errno, std::generic_category(),
+                                        "fsync " + tmp};
+            }
+            if (0 != ::close(std::exchange(fd, -1))) {
+                throw std::system_error{errno, std::generic_category(),
+                                        "close " + tmp};
+            }
+            if (0 != std::rename(tmp.c_str(), path.c_str())) {
+                throw std::system_error{errno, std::generic_category(),
+                                        "rename " + tmp};
+            }
+        } catch (...) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            std::remove(tmp.c_str());
+            throw;
+        }
+        syncDirectory(path);
+    }
+
+    // Part of the format; see ConfigHash.h. The low bits pick the slot,
+    // the high 32 bits are its tag.
+    static uint64_t hash(std::string_view key) { return configHash(key); }
+
+private:
+    static void writeAll(int fd, const void* data, size_t size,
+                         const std::string& path) {
+        const auto* bytes = static_cast<const char*>(data);
+        while (0u != size) {
+            const auto written = ::write(fd, bytes, size);
+            if (written < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                throw std::system_error{errno, std::generic_category(),
+                                        "write " + path};
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    // Makes the rename into path's directory durable.
+    static void syncDirectory(const std::string& path) {
+        const auto slash = path.rfind('/');
+        const auto dir = std::string::npos == slash ? std::string{"."}
+                         : 0u == slash              ? std::string{"/"}
+                                                    : path.substr(0, slash);
+        const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+            throw std::system_error{errno, std::generic_category(),
+                                    "open " + dir};
+        }
+        const bool synced = 0 == fsync(fd);
+        const auto error = errno;
+        ::close(fd);
+        if (!synced) {
+            throw std::system_error{error, std::generic_category(),
+                                    "fsync " + dir};
+        }
+    }
+
+    // Whether every section the header describes lies inside the file.
+    bool fits(const ConfigImageHeader& header) const {
+        const auto within = [&](uint64_t offset, uint64_t count,
+                                size_t element) {
+            return 0u == offset % alignof(uint32_t) && offset <= _size &&
+                   count <= (_size - offset) / element;
+        };
+        return ConfigImageHeader::kMagic == header.magic &&
+               ConfigImageHeader::kVersion == header.version &&
+               std::has_single_bit(header.indexSize) &&
+               header.indexSize > header.count &&
+               within(header.entriesOffset, header.count,
+                      sizeof(ConfigImageEntry)) &&
+               within(header.indexOffset, header.indexSize,
+                      sizeof(ConfigImageSlot)) &&
+               within(header.poolOffset, header.poolSize, 1);
+    }
+
+    // Offsets are not trusted: a damaged image yields wrong strings, never
+    // reads outside the mapping.
+    std::string_view text(uint32_t offset, uint32_t length) const {
+        if (offset > _pool.size()) {
+            return {};
+        }
+        return _pool.substr(offset, length);
+    }
+
+    std::string_view keyOf(const ConfigImageEntry& entry) const {
+        return text(entry.keyOffset, entry.keyLength);
+    }
+
+    void unmap() {
+        if (nullptr != _base) {
+            munmap(_base, _size);
+            _base = nullptr;
+        }
+    }
+
+    void* _base = nullptr;
+    size_t _size = 0;
+    const ConfigImageEntry* _entries = nullptr;
+    size_t _count = 0;
+    const ConfigImageSlot* _index = nullptr;
+    uint64_t _mask = 0;
+    std::string_view _pool;
+};
@@ -0,0 +1,380 @@
+#pragma once
+
+#include "ConfigHash.h"
+#include "rcu.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Process-wide numbering of configuration keys. A key keeps its id for the
+// life of the process, whichever tables it appears in, so a ConfigKey
+// resolved once stays valid across reloads. Interning takes a lock; it only
+// happens when resolving keys and building tables, never when reading.
+class ConfigKeys {
+public:
+    static ConfigKeys& instance() {
+        static ConfigKeys keys;
+        return keys;
+    }
+
+    uint32_t intern(std::string_view key) {
+        std::lock_guard<std::mutex> l{_m};
+        const auto it = _ids.find(key);
+        if (it != _ids.end()) {
+            return it->second;
+        }
+        const auto id = static_cast<uint32_t>(_names.size());
+        const auto& name = _names.emplace_back(key);
+        _ids.emplace(name, id);
+        return id;
+    }
+
+private:
+    ConfigKeys() = default;
+
+    std::mutex _m;
+    // A deque, so the views in _ids stay put as it grows.
+    std::deque<std::string> _names;
+    std::unordered_map<std::string_view, uint32_t> _ids;
+};
+
+// A key resolved ahead of time; see ConfigurationSettings::resolve().
+struct ConfigKey {
+    uint32_t id;
+};
+
+// An immutable key/value table. Lookups by name go through a minimal
+// perfect hash (hash and displace): one hash of the key, two array reads
+// and one comparison to reject keys that are not in the table. Lookups by
+// ConfigKey are a single array read. Keys and values live in one buffer
+// and are handed out as views into it.
+class ConfigTable {
+public:
+    ConfigTable() = default;
+
+    // Later duplicates of a key replace earlier ones.
+    explicit ConfigTable(
+        std::vector<std::pair<std::string, std::string>> settings) {
+        std::unordered_map<std::string_view, size_t> latest;
+        for (size_t i = 0; i < settings.size(); ++i) {
+            latest[settings[i].first] = i;
+        }
+        std::vector<size_t> order;
+        order.reserve(latest.size());
+        for (size_t i = 0; i < settings.size(); ++i) {
+            if (latest[settings[i].first] == i) {
+                order.push_back(i);
+            }
+        }
+        std::vector<uint64_t> hashes;
+        hashes.reserve(order.size());
+        for (auto i : order) {
+            hashes.push_back(hash(settings[i].first));
+        }
+        const auto slots = place(hashes);
+
+        _entries.resize(order.size());
+        auto& keys = ConfigKeys::instance();
+        for (size_t k = 0; k < order.size(); ++k) {
+            const auto& [key, value] = settings[order[k]];
+            // Offsets and lengths are 32-bit.
+            if (_text.size() + key.size() + value.size() >
+                std::numeric_limits<uint32_t>::max()) {
+                throw std::length_error{"ConfigTable: settings over 4 GiB"};
+            }
+            auto& entry = _entries[slots[k]];
+            entry.keyOffset = static_cast<uint32_t>(_text.size());
+            entry.keyLength = static_cast<uint32_t>(key.size());
+            _text += key;
+            entry.valueOffset = static_cast<uint32_t>(_text.size());
+            entry.valueLength = static_cast<uint32_t>(value.size());
+            _text += value;
+            const auto id = keys.intern(key);
+            if (id >= _slotOfKey.size()) {
+                _slotOfKey.resize(id + 1, kMissing);
+            }
+            _slotOfKey[id] = slots[k];
+        }
+    }
+
+    // Reads `key = value` lines. Blank lines and lines starting with '#'
+    // are skipped and whitespace around keys and values is dropped. Throws
+    // std::runtime_error naming the first malformed line.
+    static ConfigTable parse(std::istream& in, const std::string& source) {
+        return ConfigTable{readSettings(in, source)};
+    }
+
+    // The pairs parse() builds a table from, in file order.
+    static std::vector<std::pair<std::string, std::string>> readSettings(
+        std::istream& in, const std::string& source) {
+        std::vector<std::pair<std::string, std::string>> settings;
+        std::string line;
+        for (size_t number = 1; std::getline(in, line); ++number) {
+            const auto text = trim(line);
+            if (text.empty() || '#' == text.front()) {
+                continue;
+            }
+            const auto equals = text.find('=');
+            const auto key = trim(text.substr(0, equals));
+            if (std::string_view::npos == equals || key.empty()) {
+                throw std::runtime_error{source + ":" + std::to_string(number) +
+                                         ": expected key = value"};
+            }
+            settings.emplace_back(key, trim(text.substr(equals + 1)));
+        }
+        return settings;
+    }
+
+    static ConfigTable load(const std::string& path) {
+        std::ifstream in{path};
+        if (!in) {
+            throw std::runtime_error{"cannot open " + path};
+        }
+        return parse(in, path);
+    }
+
+    size_t size() const { return _entries.size(); }
+
+    std::optional<std::string_view> find(std::string_view key) const {
+        if (_entries.empty()) {
+            return std::nullopt;
+        }
+        const auto h = hash(key);
+        const auto& entry = _entries[slotOf(h, _seeds[bucketOf(h)])];
+        if (keyOf(entry) != key) {
+            return std::nullopt;
+        }
+        return valueOf(entry);
+    }
+
+    std::optional<std::string_view> find(ConfigKey key) const {
+        if (key.id >= _slotOfKey.size() || kMissing == _slotOfKey[key.id]) {
+            return std::nullopt;
+        }
+        return valueOf(_entries[_slotOfKey[key.id]]);
+    }
+
+private:
+    static constexpr uint32_t kMissing = std::numeric_limits<uint32_t>::max();
+    // Seeds with this bit set hold a slot number instead; every bucket of
+    // one key is placed that way, so placement never has to search for
+    // the last free slots.
+    static constexpr uint32_t kDirect = uint32_t{1} << 31;
+    static constexpr uint32_t kMaxSeed = 1u << 20;
+
+    struct Entry {
+        uint32_t keyOffset = 0;
+        uint32_t keyLength = 0;
+        uint32_t valueOffset = 0;
+        uint32_t valueLength = 0;
+    };
+
+    static std::string_view trim(std::string_view text) {
+        const auto first = text.find_first_not_of(" \t\r");
+        if (std::string_view::npos == first) {
+            return {};
+        }
+        const auto last = text.find_last_not_of(" \t\r");
+        return text.substr(first, last - first + 1);
+    }
+
+    static uint64_t hash(std::string_view key) { return configHash(key); }
+    static uint64_t mix(uint64_t h) { return configMix(h); }
+
+    // Maps 32 bits onto [0, n) without a division.
+    static uint32_t reduce(uint64_t bits, size_t n) {
+        return static_cast<uint32_t>(((bits & 0xffffffff) * n) >> 32);
+    }
+
+    uint32_t bucketOf(uint64_t h) const {
+        return reduce(h >> 32, _seeds.size());
+    }
+
+    uint32_t slotOf(uint64_t h, uint32_t seed) const {
+        if (0u != (seed & kDirect)) {
+            return seed & ~kDirect;
+        }
+        return reduce(mix(h + seed), _entries.size());
+    }
+
+    // Picks a seed for every bucket so that the keys land on distinct
+    // slots, largest buckets first while the table is still empty. Returns
+    // the slot of every key.
+    std::vector<uint32_t> place(const std::vector<uint64_t>& hashes) {
+        const auto n = hashes.size();
+        _entries.resize(n);
+        _seeds.assign(std::max<size_t>(1, (n + 1) / 2), 0);
+        std::vector<std::vector<uint32_t>> buckets(_seeds.size());
+        for (uint32_t k = 0; k < n; ++k) {
+            buckets[bucketOf(hashes[k])].push_back(k);
+        }
+        std::vector<uint32_t> order(buckets.size());
+        for (uint32_t b = 0; b < order.size(); ++b) {
+            order[b] = b;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::vector<uint32_t> slots(n);
+        std::vector<bool> taken(n);
+        uint32_t nextFree = 0;
+        for (auto b : order) {
+            const auto& keys = buckets[b];
+            if (keys.size() == 1) {
+                while (taken[nextFree]) {
+                    ++nextFree;
+                }
+                taken[nextFree] = true;
+                slots[keys[0]] = nextFree;
+                _seeds[b] = kDirect | nextFree;
+                continue;
+            }
+            if (keys.empty()) {
+                continue;
+            }
+            bool placed = false;
+            for (uint32_t seed = 0; !placed && seed < kMaxSeed; ++seed) {
+                placed = true;
+                for (size_t i = 0; placed && i < keys.size(); ++i) {
+                    const auto slot = slotOf(hashes[keys[i]], seed);
+                    placed = !taken[slot];
+                    for (size_t j = 0; placed && j < i; ++j) {
+                        placed = slots[keys[j]] != slot;
+                    }
+                    slots[keys[i]] = slot;
+                }
+                if (placed) {
+                    for (auto k : keys) {
+                        taken[slots[k]] = true;
+                    }
+                    _seeds[b] = seed;
+                }
+            }
+            if (!placed) {
+                // Only keys with the same 64-bit hash get here.
+                throw std::runtime_error{"ConfigTable: cannot place key " +
+                                         std::to_string(keys[0])};
+            }
+        }
+        return slots;
+    }
+
+    std::string_view keyOf(const Entry& entry) const {
+        return {_text.data() + entry.keyOffset, entry.keyLength};
+    }
+
+    std::string_view valueOf(const Entry& entry) const {
+        return {_text.data() + entry.valueOffset, entry.valueLength};
+    }
+
+    std::string _text;
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _seeds;
+    // Indexed by ConfigKey::id; kMissing for keys not in this table.
+    std::vector<uint32_t> _slotOfKey;
+};
+
+// The process configuration, read from a file and replaced as a whole on
+// reload(). Readers on any number of threads never lock: they pin the
+// current table for as long as a Snapshot lives, and a reload publishes
+// the new table with one atomic exchange. A live Snapshot holds one of
+// rcu_domain::max_readers reader slots (see rcu.h).
+class ConfigurationSettings {
+public:
+    // Keeps one version of the table alive; the views it returns are valid
+    // until it is destroyed. Only a named Snapshot can be read from, since
+    // a temporary one would unpin the table before the view is used.
+    class Snapshot {
+    public:
+        explicit Snapshot(const rcu_ptr<ConfigTable>& table)
+            : _reader{table} {}
+
+        std::optional<std::string_view> find(ConfigKey key) const& {
+            return _reader->find(key);
+        }
+        std::optional<std::string_view> find(std::string_view key) const& {
+            return _reader->find(key);
+        }
+        const ConfigTable& table() const& { return *_reader; }
+
+        std::optional<std::string_view> find(ConfigKey) const&& = delete;
+        std::optional<std::string_view> find(std::string_view) const&& =
+            delete;
+        const ConfigTable& table() const&& = delete;
+
+    private:
+        rcu_ptr<ConfigTable>::reader _reader;
+    };
+
+    static ConfigurationSettings& getInstance() {
+        static ConfigurationSettings instance;
+        return instance;
+    }
+
+    ConfigurationSettings(const ConfigurationSettings&) = delete;
+    ConfigurationSettings& operator=(const ConfigurationSettings&) = delete;
+
+    // Reads the file and makes it current. On an error the previous table
+    // stays in place and the exception propagates.
+    void load(const std::string& path) {
+        auto next = std::make_unique<ConfigTable>(ConfigTable::load(path));
+        {
+            std::lock_guard<std::mutex> l{_pathMutex};
+            _path = path;
+        }
+        publish(std::move(next));
+    }
+
+    // Reads the file given to the last load() again.
+    void reload() {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> l{_pathMutex};
+            path = _path;
+        }
+        publish(std::make_unique<ConfigTable>(ConfigTable::load(path)));
+    }
+
+    // Resolve keys once, e.g. at startup, and read them by handle.
+    static ConfigKey resolve(std::string_view key) {
+        return {ConfigKeys::instance().intern(key)};
+    }
+
+    Snapshot snapshot() const { return Snapshot{_table}; }
+
+    // Copies the value out; prefer snapshot() on hot paths.
+    std::string getSetting(std::string_view key) const {
+        const auto pinned = snapshot();
+        const auto value = pinned.find(key);
+        return value ? std::string{*value} : std::string{};
+    }
+
+private:
+    ConfigurationSettings() = default;
+
+    // Waits for readers of the replaced table, so it is freed here rather
+    // than on some later reload.
+    void publish(std::unique_ptr<ConfigTable> next) {
+        _table.store(std::move(next));
+        _table.synchronize();
+    }
+
+    rcu_ptr<ConfigTable> _table;
+    std::mutex _pathMutex;
+    std::string _path;
+};
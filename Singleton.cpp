@@ -92,3 +92,156 @@ class Single : public SingletonBase<Single>
 public:
     void demo() { std::cout << "demo" << '\n'; }
 };
+//ConfigurationSettings_hot_reload.cpp
+#include "ConfigTable.h"
+
+#include <fstream>
+#include <iostream>
+
+int main() {
+    {
+        std::ofstream out{"pantheon.conf"};
+        out << "# god = domain\n"
+            << "godOfTheUnderworld = Hades\n"
+            << "godOfTheSea = Poseidon\n";
+    }
+    auto& settings = ConfigurationSettings::getInstance();
+    settings.load("pantheon.conf");
+
+    // Resolve once, then every read is an array lookup with no allocation.
+    static const ConfigKey underworld =
+        ConfigurationSettings::resolve("godOfTheUnderworld");
+    {
+        const auto snapshot = settings.snapshot();
+        std::cout << snapshot.find(underworld).value_or("") << std::endl;
+    }
+
+    {
+        std::ofstream out{"pantheon.conf"};
+        out << "godOfTheUnderworld = Pluto\n";
+    }
+    settings.reload();
+    {
+        const auto snapshot = settings.snapshot();
+        std::cout << snapshot.find(underworld).value_or("") << ' '
+                  << snapshot.find("godOfTheSea").value_or("(gone)") << std::endl;
+    }
+    return 0;
+}
+//ConfigurationSettings_mapped.cpp
+#include "ConfigImage.h"
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+
+// Both variants read pantheon.cfg, compiled offline with
+// `ConfigCompiler pantheon.conf pantheon.cfg`, straight from the mapping.
+class ConfigurationSettings {
+public:
+    static ConfigurationSettings& getInstance() {
+        std::call_once(initInstanceFlag, createInstance);
+        return *instance;
+    }
+
+    std::string_view getSetting(std::string_view key) const {
+        return _image.find(key).value_or("");
+    }
+    ConfigurationSettings(const ConfigurationSettings&) = delete;
+    ConfigurationSettings& operator=(const ConfigurationSettings&) = delete;
+private:
+    ConfigurationSettings() : _image{"pantheon.cfg"} {}
+    ~ConfigurationSettings() = default;
+
+    static void createInstance() {
+        instance = new ConfigurationSettings();
+    }
+
+    ConfigImage _image;
+    static ConfigurationSettings* instance;
+    static std::once_flag initInstanceFlag;
+};
+
+ConfigurationSettings* ConfigurationSettings::instance = nullptr;
+std::once_flag ConfigurationSettings::initInstanceFlag;
+
+template <class T>
+class SingletonBase {
+protected:
+    SingletonBase() {}
+public:
+    SingletonBase(SingletonBase const &) = delete;
+    SingletonBase& operator=(SingletonBase const&) = delete;
+
+    static T& instance()
+    {
+         static T single;
+         return single;
+    }
+};
+
+class MappedSettings : public SingletonBase<MappedSettings>
+{
+    MappedSettings() : _image{"pantheon.cfg"} {}
+    friend class SingletonBase<MappedSettings>;
+public:
+    std::string_view getSetting(std::string_view key) const {
+        return _image.find(key).value_or("");
+    }
+private:
+    ConfigImage _image;
+};
+
+int main() {
+    ConfigImage::compile({{"godOfTheUnderworld", "Hades"},
+                          {"godOfTheSea", "Poseidon"}},
+                         "pantheon.cfg");
+    std::cout << ConfigurationSettings::getInstance().getSetting("godOfTheUnderworld")
+              << ' ' << MappedSettings::instance().getSetting("godOfTheSea")
+              << std::endl;
+    return 0;
+}
+//SingletonBase_registry.cpp
+#include "SingletonRegistry.h"
+
+#include <iostream>
+#include <string>
+
+// Reached through a thread_local pointer after the first call on each
+// thread, and destroyed by SingletonRegistry::shutdown() rather than leaked.
+class ConfigurationSettings : public RegisteredSingleton<ConfigurationSettings>
+{
+    ConfigurationSettings() { std::cout << "settings up" << std::endl; }
+    ~ConfigurationSettings() { std::cout << "settings down" << std::endl; }
+    friend class SingletonRegistry;
+public:
+    std::string getSetting(const std::string& key) const {
+        if (key == "godOfTheUnderworld") {
+            return "Hades";
+        }
+        return "";
+    }
+};
+
+class Oracle : public RegisteredSingleton<Oracle>
+{
+    // Uses the settings, so they are constructed first and destroyed last.
+    Oracle() : _god{ConfigurationSettings::instance().getSetting("godOfTheUnderworld")} {
+        std::cout << "oracle up" << std::endl;
+    }
+    ~Oracle() { std::cout << "oracle down" << std::endl; }
+    friend class SingletonRegistry;
+public:
+    const std::string& ask() const { return _god; }
+private:
+    std::string _god;
+};
+
+int main() {
+    // Eager and in a fixed order, before any other thread starts.
+    SingletonRegistry::initialize<ConfigurationSettings, Oracle>();
+    std::cout << Oracle::instance().ask() << std::endl;
+    SingletonRegistry::shutdown();
+    return 0;
+}
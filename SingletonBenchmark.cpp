@@ -0,0 +1,246 @@
+// Start-up and lookup cost of the configuration singletons' backends.
+//
+// Build: g++ -std=c++20 -O2 -pthread SingletonBenchmark.cpp
+// Run:   ./a.out [config|access]
+//        (no argument runs everything)
+//
+// 'config' writes a million-key configuration as text, compiles it to a
+// config image, and compares loading and querying each. It exits non-zero
+// if the backends disagree on any key. The files stay in the page cache,
+// so load times are for a warm cache.
+//
+// 'access' times reaching a singleton in a hot loop through each of the
+// ways Singleton.cpp does it and through SingletonRegistry, and checks that
+// the registry tears its instances down.
+#include "ConfigImage.h"
+#include "ConfigTable.h"
+#include "SingletonRegistry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kConfigKeys = 1000000;
+constexpr size_t kLookups = 4000000;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string keyName(size_t i) {
+    return "service." + std::to_string(i % 997) + ".setting." +
+           std::to_string(i);
+}
+
+// Sums value lengths so the lookups cannot be optimized away.
+template <typename Find>
+size_t timeLookups(const char* name, const std::vector<size_t>& order,
+                   Find&& find) {
+    size_t checksum = 0;
+    const auto start = Clock::now();
+    for (size_t i = 0; i < kLookups; ++i) {
+        checksum += find(order[i % order.size()]).value_or("").size();
+    }
+    const auto seconds = secondsSince(start);
+    printf("%-24s %8.1f M lookups/s %7.1f ns/lookup\n", name,
+           kLookups / seconds / 1e6, seconds * 1e9 / kLookups);
+    return checksum;
+}
+
+bool benchConfig() {
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto textPath = (dir / "SingletonBenchmark.conf").string();
+    const auto imagePath = (dir / "SingletonBenchmark.cfg").string();
+    printf("config: %zu keys\n", kConfigKeys);
+
+    std::vector<std::string> keys(kConfigKeys);
+    {
+        std::ofstream out{textPath};
+        out << "# generated by SingletonBenchmark\n";
+        for (size_t i = 0; i < kConfigKeys; ++i) {
+            keys[i] = keyName(i);
+            out << keys[i] << " = value-" << i * 7919 << '\n';
+        }
+    }
+
+    auto start = Clock::now();
+    {
+        std::ifstream in{textPath};
+        ConfigImage::compile(ConfigTable::readSettings(in, textPath),
+                             imagePath);
+    }
+    printf("%-24s %8.1f ms (offline)\n", "compile", secondsSince(start) * 1e3);
+
+    start = Clock::now();
+    const auto table = ConfigTable::load(textPath);
+    printf("%-24s %8.1f ms\n", "load text", secondsSince(start) * 1e3);
+
+    start = Clock::now();
+    const ConfigImage image{imagePath};
+    const auto first = image.find(keys.front());
+    printf("%-24s %8.3f ms\n", "map image", secondsSince(start) * 1e3);
+
+    std::vector<ConfigKey> handles(kConfigKeys);
+    for (size_t i = 0; i < kConfigKeys; ++i) {
+        handles[i] = ConfigurationSettings::resolve(keys[i]);
+    }
+    std::vector<size_t> order(kConfigKeys);
+    for (size_t i = 0; i < kConfigKeys; ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64{42});
+
+    const auto byName =
+        timeLookups("text table, by name", order,
+                    [&](size_t i) { return table.find(keys[i]); });
+    const auto byHandle =
+        timeLookups("text table, by handle", order,
+                    [&](size_t i) { return table.find(handles[i]); });
+    const auto mapped =
+        timeLookups("image, by name", order,
+                    [&](size_t i) { return image.find(keys[i]); });
+
+    bool same = first && byName == byHandle && byName == mapped &&
+                image.size() == table.size() &&
+                !image.find("service.missing") &&
+                !table.find("service.missing");
+    for (size_t i = 0; same && i < kConfigKeys; ++i) {
+        same = table.find(keys[i]) == image.find(keys[i]);
+    }
+    std::filesystem::remove(textPath);
+    std::filesystem::remove(imagePath);
+    if (!same) {
+        printf("FAIL: the text table and the image disagree\n");
+    }
+    return same;
+}
+
+constexpr uint64_t kAccesses = 200000000;
+
+// The singletons below record when they were made. Like any singleton that
+// does real work on construction, that keeps them from being initialized
+// at compile time, which would remove the guard being measured.
+
+// SingletonBase<T>::instance(): a function-local static, so every call
+// checks its guard variable.
+class LocalStatic {
+public:
+    static LocalStatic& instance() {
+        static LocalStatic single;
+        return single;
+    }
+    uint64_t hits = 0;
+    Clock::time_point created;
+
+private:
+    LocalStatic() : created{Clock::now()} {}
+};
+
+// ConfigurationSettings::getInstance(): std::call_once on every call and an
+// instance that is never deleted.
+class CallOnce {
+public:
+    static CallOnce& getInstance() {
+        std::call_once(_flag, [] { _instance = new CallOnce; });
+        return *_instance;
+    }
+    uint64_t hits = 0;
+    Clock::time_point created;
+
+private:
+    CallOnce() : created{Clock::now()} {}
+
+    static inline CallOnce* _instance = nullptr;
+    static inline std::once_flag _flag;
+};
+
+class Registered : public RegisteredSingleton<Registered> {
+    friend class ::SingletonRegistry;
+
+public:
+    uint64_t hits = 0;
+    Clock::time_point created;
+    static inline uint64_t destroyed = 0;
+
+private:
+    Registered() : created{Clock::now()} {}
+    ~Registered() { ++destroyed; }
+};
+
+// Counts through the instance get() returns. The compiler-only fence
+// stands in for the rest of a hot loop: it keeps the call from being
+// hoisted or the loop folded, but emits no instruction.
+template <typename Get>
+uint64_t timeAccess(const char* name, Get&& get) {
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < kAccesses; ++i) {
+        ++get().hits;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    const auto seconds = secondsSince(start);
+    printf("%-24s %8.2f ns/access\n", name, seconds * 1e9 / kAccesses);
+    return get().hits;
+}
+
+bool benchAccess() {
+    printf("access: %llu calls\n", static_cast<unsigned long long>(kAccesses));
+    // Start-up order is explicit; this also keeps construction out of the
+    // timed loop, as the warm-up call does for the other two.
+    SingletonRegistry::initialize<Registered>();
+    LocalStatic::instance();
+    CallOnce::getInstance();
+
+    auto& held = Registered::instance();
+    const auto baseline =
+        timeAccess("reference held", [&]() -> Registered& { return held; });
+    const auto local = timeAccess(
+        "function-local static",
+        []() -> LocalStatic& { return LocalStatic::instance(); });
+    const auto once = timeAccess(
+        "std::call_once",
+        []() -> CallOnce& { return CallOnce::getInstance(); });
+    const auto registry = timeAccess(
+        "registry, thread_local",
+        []() -> Registered& { return Registered::instance(); });
+
+    SingletonRegistry::shutdown();
+    const bool ok = kAccesses == baseline && kAccesses == local &&
+                    kAccesses == once && 2 * kAccesses == registry &&
+                    1u == Registered::destroyed &&
+                    0u == Registered::instance().hits;
+    SingletonRegistry::shutdown();
+    if (!ok) {
+        printf("FAIL: lost accesses or the registry did not tear down\n");
+    }
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto selected = [&](const char* section) {
+        return argc < 2 || 0 == strcmp(argv[1], section);
+    };
+    if (selected("config") && !benchConfig()) {
+        return 1;
+    }
+    if (selected("access") && !benchAccess()) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+// Owner of the singletons reached through SingletonRegistry::get<T>().
+//
+// The first get<T>() on a thread looks the instance up, constructing it if
+// need be, under the registry's lock and caches the pointer in a
+// thread_local slot. After that a call on the same thread is a TLS read and
+// a comparison with the registry's epoch: no guard variable, no once_flag.
+//
+// Instances are constructed on first use, or eagerly and in a chosen order
+// by initialize<A, B, ...>(), and are destroyed in reverse order of
+// construction by shutdown(). Nothing is leaked: if main() does not call
+// shutdown(), it runs at exit, where a function-local static constructed
+// at the same moment as the first singleton would be destroyed. shutdown()
+// bumps the epoch, which sends every thread back to the slow path; it must
+// not race with get() on other threads. A destructor may still use the
+// singletons that have not been destroyed yet.
+//
+// The exit-time shutdown() is final: a get() after it, e.g. from the
+// destructor of a static constructed before the first singleton, builds
+// an instance that is never destroyed. Call shutdown() at the end of
+// main() to keep that from happening.
+//
+// T is constructed with `new T` from within the registry, so a T with a
+// private constructor and destructor declares `friend class
+// SingletonRegistry;`.
+class SingletonRegistry {
+public:
+    template <class T>
+    static T& get() {
+        // Trivial, so the slot needs no guard or TLS wrapper either.
+        thread_local Cache<T> cache;
+        if (cache.epoch == _epoch.load(std::memory_order_relaxed)) {
+            return *cache.instance;
+        }
+        return refresh(cache);
+    }
+
+    // Constructs the instances that do not exist yet, left to right.
+    template <class... Ts>
+    static void initialize() {
+        (get<Ts>(), ...);
+    }
+
+    // Destroys every instance, the most recently constructed first. Later
+    // calls to get() construct new ones.
+    static void shutdown() {
+        Lock l;
+        // A destructor that brings a singleton back adds it to the end, so
+        // it goes too.
+        while (!_owned.empty()) {
+            const auto destroy = _owned.back();
+            _owned.pop_back();
+            // Also drops what the previous destructor cached.
+            _epoch.fetch_add(1, std::memory_order_relaxed);
+            destroy();
+        }
+    }
+
+private:
+    template <class T>
+    struct Cache {
+        T* instance = nullptr;
+        // 0 never matches, so the first call takes the slow path.
+        uint64_t epoch = 0;
+    };
+
+    // Reentrant, so a constructor may get() the singletons it uses.
+    class Lock {
+    public:
+        Lock() {
+            if (0u == _depth++) {
+                _m.lock();
+            }
+        }
+        ~Lock() {
+            if (0u == --_depth) {
+                _m.unlock();
+            }
+        }
+        Lock(const Lock&) = delete;
+        Lock& operator=(const Lock&) = delete;
+    };
+
+    template <class T>
+    static T& refresh(Cache<T>& cache) {
+        Lock l;
+        if (nullptr == _instance<T>) {
+            create<T>();
+        }
+        cache.instance = _instance<T>;
+        cache.epoch = _epoch.load(std::memory_order_relaxed);
+        return *cache.instance;
+    }
+
+    template <class T>
+    static void create() {
+        if (_constructing<T>) {
+            throw std::logic_error{std::string{"SingletonRegistry: "} +
+                                   typeid(T).name() +
+                                   " needs itself to be constructed"};
+        }
+        if (!_atExit) {
+            if (0 != std::atexit(shutdown)) {
+                throw std::runtime_error{"SingletonRegistry: atexit failed"};
+            }
+            _atExit = true;
+        }
+        _constructing<T> = true;
+        try {
+            _instance<T> = new T;
+        } catch (...) {
+            _constructing<T> = false;
+            throw;
+        }
+        _constructing<T> = false;
+        // Pushed once T is complete, behind whatever its constructor
+        // created, so that T goes first. A reservation made before
+        // constructing T could have been used up by those.
+        try {
+            _owned.push_back(
+                [] { delete std::exchange(_instance<T>, nullptr); });
+        } catch (...) {
+            delete std::exchange(_instance<T>, nullptr);
+            throw;
+        }
+    }
+
+    // All constant-initialized, so usable from any static constructor and
+    // still alive when shutdown() runs at exit.
+    //
+    // Starts at 1, so it never matches a fresh Cache.
+    static inline std::atomic<uint64_t> _epoch{1};
+    static inline std::mutex _m;
+    static inline thread_local unsigned _depth = 0;
+    // The rest are guarded by _m. _owned holds the instances' destructors
+    // in order of construction.
+    static inline std::vector<void (*)()> _owned;
+    static inline bool _atExit = false;
+    template <class T>
+    static inline T* _instance = nullptr;
+    template <class T>
+    static inline bool _constructing = false;
+};
+
+// SingletonBase<T> (see Singleton.cpp) with instance() served by the
+// registry. T declares `friend class SingletonRegistry;`.
+template <class T>
+class RegisteredSingleton {
+protected:
+    RegisteredSingleton() = default;
+    ~RegisteredSingleton() = default;
+
+public:
+    RegisteredSingleton(const RegisteredSingleton&) = delete;
+    RegisteredSingleton& operator=(const RegisteredSingleton&) = delete;
+
+    static T& instance() { return SingletonRegistry::get<T>(); }
+};
@@ -22,42 +22,621 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
 #include <functional>
 #include <future>
+#include <iterator>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
 #include <thread>
+#include <type_traits>
 #include <utility>
+#include <variant>
 #include <vector>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 #ifndef THREAD_POOL_NAMESPACE_NAME
 #define THREAD_POOL_NAMESPACE_NAME thread_pool
 #endif
 
+// Bytes of inline storage in every queued task. Callables (including their
+// captures) up to this size are stored without a heap allocation.
+#ifndef THREAD_POOL_TASK_INLINE_SIZE
+#define THREAD_POOL_TASK_INLINE_SIZE 64
+#endif
+
 namespace THREAD_POOL_NAMESPACE_NAME {
 
+// Log2-bucketed histogram of durations. Recording is one relaxed atomic
+// increment, so any thread can update it without coordination.
+class LatencyHistogram {
+public:
+    // Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds; bucket 0 also
+    // takes zero.
+    static constexpr size_t kBuckets = 40;
+
+    struct Snapshot {
+        std::array<uint64_t, kBuckets> counts{};
+
+        uint64_t total() const {
+            uint64_t sum = 0;
+            for (auto c : counts) {
+                sum += c;
+            }
+            return sum;
+        }
+
+        // Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+        std::chrono::nanoseconds percentile(double p) const {
+            const auto rank = static_cast<uint64_t>(total() * p / 100.0);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBuckets; ++i) {
+                seen += counts[i];
+                if (0u != counts[i] && seen >= rank) {
+                    return std::chrono::nanoseconds{int64_t{2} << i};
+                }
+            }
+            return std::chrono::nanoseconds{0};
+        }
+
+        Snapshot& operator+=(const Snapshot& other) {
+            for (size_t i = 0; i < kBuckets; ++i) {
+                counts[i] += other.counts[i];
+            }
+            return *this;
+        }
+    };
+
+    void record(std::chrono::nanoseconds duration) {
+        const auto ns =
+            static_cast<uint64_t>(std::max<int64_t>(duration.count(), 1));
+        const auto bucket =
+            std::min<size_t>(kBuckets - 1, std::bit_width(ns) - 1);
+        _counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const {
+        Snapshot result;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            result.counts[i] = _counts[i].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> _counts{};
+};
+
+class ThreadPool;
+
+template <typename T>
+class Future;
+
+template <typename T>
+class Task;
+
+namespace detail {
+class FutureStateBase;
+} // namespace detail
+
 class ThreadPool {
 private:
+    // Move-only type-erased callable. Small callables live in the inline
+    // buffer; larger ones (or ones that may throw on move) go to the heap.
     class TaskWrapper {
-        struct ImplBase {
-            virtual void call() = 0;
-            virtual ~ImplBase() = default;
+    public:
+        static constexpr size_t kInlineSize = THREAD_POOL_TASK_INLINE_SIZE;
+
+        TaskWrapper() = default;
+
+        template <typename F,
+                  typename = std::enable_if_t<
+                      !std::is_same_v<std::decay_t<F>, TaskWrapper>>>
+        TaskWrapper(F&& f) {
+            using Fn = std::decay_t<F>;
+            if constexpr (fitsInline<Fn>()) {
+                ::new (static_cast<void*>(_storage)) Fn(std::forward<F>(f));
+                _ops = &inlineOps<Fn>;
+            } else {
+                ::new (static_cast<void*>(_storage))
+                    Fn*(new Fn(std::forward<F>(f)));
+                _ops = &heapOps<Fn>;
+            }
+        }
+
+        TaskWrapper(TaskWrapper&& other) noexcept
+            : _ops{other._ops}, _enqueuedAt{other._enqueuedAt} {
+            if (_ops) {
+                _ops->move(_storage, other._storage);
+                other._ops = nullptr;
+            }
+        }
+
+        TaskWrapper& operator=(TaskWrapper&& other) noexcept {
+            if (this != &other) {
+                reset();
+                if (other._ops) {
+                    other._ops->move(_storage, other._storage);
+                    _ops = other._ops;
+                    other._ops = nullptr;
+                }
+                _enqueuedAt = other._enqueuedAt;
+            }
+            return *this;
+        }
+
+        ~TaskWrapper() { reset(); }
+
+        explicit operator bool() const { return nullptr != _ops; }
+
+        void operator()() { _ops->call(_storage); }
+
+        // When the task was queued, in steady_clock nanoseconds; 0 unless
+        // the pool records timings.
+        int64_t enqueuedAt() const { return _enqueuedAt; }
+        void setEnqueuedAt(int64_t ns) { _enqueuedAt = ns; }
+
+    private:
+        struct Ops {
+            void (*call)(void*);
+            // Move-constructs into dst and destroys src.
+            void (*move)(void* dst, void* src) noexcept;
+            void (*destroy)(void*) noexcept;
         };
-        std::unique_ptr<ImplBase> impl;
 
-        template <typename F>
-        struct ImplType : ImplBase {
-            F f;
-            ImplType(F&& f_) : f{std::forward<F>(f_)} {}
-            void call() final { f(); }
+        template <typename Fn>
+        static constexpr bool fitsInline() {
+            return sizeof(Fn) <= kInlineSize &&
+                   alignof(Fn) <= alignof(std::max_align_t) &&
+                   std::is_nothrow_move_constructible_v<Fn>;
+        }
+
+        template <typename Fn>
+        static constexpr Ops inlineOps{
+            [](void* p) { (*static_cast<Fn*>(p))(); },
+            [](void* dst, void* src) noexcept {
+                ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+                static_cast<Fn*>(src)->~Fn();
+            },
+            [](void* p) noexcept { static_cast<Fn*>(p)->~Fn(); }};
+
+        template <typename Fn>
+        static constexpr Ops heapOps{
+            [](void* p) { (**static_cast<Fn**>(p))(); },
+            [](void* dst, void* src) noexcept {
+                ::new (dst) Fn*(*static_cast<Fn**>(src));
+            },
+            [](void* p) noexcept { delete *static_cast<Fn**>(p); }};
+
+        void reset() {
+            if (_ops) {
+                _ops->destroy(_storage);
+                _ops = nullptr;
+            }
+        }
+
+        alignas(std::max_align_t) unsigned char _storage[kInlineSize];
+        const Ops* _ops = nullptr;
+        // Fits in what would otherwise be tail padding.
+        int64_t _enqueuedAt = 0;
+    };
+
+    // Growable circular buffer behind the mutex-guarded queues. Unlike
+    // std::deque it keeps its storage once grown, so a pool in steady state
+    // stops allocating per task.
+    template <typename T>
+    class RingDeque {
+    public:
+        bool empty() const { return 0u == _size; }
+        size_t size() const { return _size; }
+        const T& front() const { return _slots[_head]; }
+
+        void pushBack(T value) {
+            reserveOne();
+            _slots[(_head + _size) & (_slots.size() - 1)] = std::move(value);
+            ++_size;
+        }
+
+        void pushFront(T value) {
+            reserveOne();
+            _head = (_head - 1) & (_slots.size() - 1);
+            _slots[_head] = std::move(value);
+            ++_size;
+        }
+
+        T popFront() {
+            T value = std::move(_slots[_head]);
+            _head = (_head + 1) & (_slots.size() - 1);
+            --_size;
+            return value;
+        }
+
+        T popBack() {
+            --_size;
+            return std::move(_slots[(_head + _size) & (_slots.size() - 1)]);
+        }
+
+    private:
+        void reserveOne() {
+            if (_size < _slots.size()) {
+                return;
+            }
+            std::vector<T> grown(_slots.empty() ? 16 : 2 * _slots.size());
+            for (size_t i = 0; i < _size; ++i) {
+                grown[i] = std::move(_slots[(_head + i) & (_slots.size() - 1)]);
+            }
+            _slots.swap(grown);
+            _head = 0;
+        }
+
+        std::vector<T> _slots;
+        size_t _head = 0;
+        size_t _size = 0;
+    };
+
+    // Per-worker deque: the owner pushes and pops at the front, thieves take
+    // from the back so they pick the oldest (usually largest) work first.
+    class WorkStealingQueue {
+    public:
+        void push(TaskWrapper task) {
+            std::lock_guard<std::mutex> l{_m};
+            _q.pushFront(std::move(task));
+        }
+
+        template <typename Iterator>
+        size_t pushBulk(Iterator first, Iterator last, int64_t enqueuedAt) {
+            size_t count = 0;
+            std::lock_guard<std::mutex> l{_m};
+            for (; first != last; ++first, ++count) {
+                TaskWrapper task{*first};
+                task.setEnqueuedAt(enqueuedAt);
+                _q.pushFront(std::move(task));
+            }
+            return count;
+        }
+
+        bool tryPop(TaskWrapper& task) {
+            std::lock_guard<std::mutex> l{_m};
+            if (_q.empty()) {
+                return false;
+            }
+            task = _q.popFront();
+            return true;
+        }
+
+        bool trySteal(TaskWrapper& task) {
+            std::lock_guard<std::mutex> l{_m};
+            if (_q.empty()) {
+                return false;
+            }
+            task = _q.popBack();
+            return true;
+        }
+
+    private:
+        RingDeque<TaskWrapper> _q;
+        std::mutex _m;
+    };
+
+    // Bounded multi-producer/multi-consumer ring (D. Vyukov). Every cell
+    // carries a sequence number telling producers and consumers whose turn it
+    // is, so a push or pop is one CAS on the shared position plus a store to
+    // the cell.
+    template <typename T>
+    class MpmcQueue {
+    public:
+        explicit MpmcQueue(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            _mask = size - 1;
+            _cells = std::make_unique<Cell[]>(size);
+            for (size_t i = 0; i < size; ++i) {
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool tryPush(T& value) {
+            auto pos = _enqueuePos.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = _cells[pos & _mask];
+                const auto seq = cell.sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+                if (0 == diff) {
+                    if (_enqueuePos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.data = std::move(value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = _enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool tryPop(T& value) {
+            auto pos = _dequeuePos.load(std::memory_order_relaxed);
+            for (;;) {
+                auto& cell = _cells[pos & _mask];
+                const auto seq = cell.sequence.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+                if (0 == diff) {
+                    if (_dequeuePos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        value = std::move(cell.data);
+                        cell.sequence.store(pos + _mask + 1,
+                                            std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = _dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct alignas(64) Cell {
+            std::atomic<size_t> sequence;
+            T data;
         };
 
+        std::unique_ptr<Cell[]> _cells;
+        size_t _mask;
+        alignas(64) std::atomic<size_t> _enqueuePos{0};
+        alignas(64) std::atomic<size_t> _dequeuePos{0};
+    };
+
+    // Tasks submitted with an explicit priority or deadline. One mutex covers
+    // every band; pollers skip it entirely while nothing is queued here.
+    class PriorityQueues {
     public:
-        template <typename F>
-        TaskWrapper(F f) : impl{std::make_unique<ImplType<F>>(std::move(f))} {}
+        using Clock = std::chrono::steady_clock;
+
+        struct BandCounters {
+            std::atomic<size_t> depth{0};
+            LatencyHistogram waitTime;
+        };
+
+        PriorityQueues(size_t bands, Clock::duration agingInterval)
+            : _bands(std::max<size_t>(bands, 1u)),
+              _counters(_bands.size() + 1),
+              _agingInterval{std::max(agingInterval, Clock::duration{1})} {}
+
+        size_t bands() const { return _bands.size(); }
+        const BandCounters& counters(size_t band) const {
+            return _counters[band];
+        }
+
+        void push(size_t band, TaskWrapper task) {
+            band = std::min(band, _bands.size() - 1);
+            // Count under the lock, so that a tryPop() taking this task
+            // cannot decrement the counters below zero first.
+            std::lock_guard<std::mutex> l{_m};
+            _bands[band].pushBack(Entry{std::move(task), Clock::now()});
+            _counters[band].depth.fetch_add(1, std::memory_order_relaxed);
+            _size.fetch_add(1, std::memory_order_release);
+        }
+
+        void pushDeadline(Clock::time_point deadline, TaskWrapper task) {
+            std::lock_guard<std::mutex> l{_m};
+            _deadlines.push_back(DeadlineEntry{
+                deadline, _sequence++, Entry{std::move(task), Clock::now()}});
+            std::push_heap(_deadlines.begin(), _deadlines.end(), later);
+            _counters.back().depth.fetch_add(1, std::memory_order_relaxed);
+            _size.fetch_add(1, std::memory_order_release);
+        }
+
+        // Earliest deadline first; otherwise the most urgent non-empty band.
+        // One pick in kAgingShare instead takes the band whose head has the
+        // best effective level, where every agingInterval spent waiting lifts
+        // a task by one band. Limiting aged picks to a share keeps a
+        // saturated low band from crowding out fresh urgent work while still
+        // guaranteeing it progress.
+        bool tryPop(TaskWrapper& task) {
+            if (0u == _size.load(std::memory_order_acquire)) {
+                return false;
+            }
+            const auto now = Clock::now();
+            Entry entry;
+            size_t band;
+            {
+                std::lock_guard<std::mutex> l{_m};
+                if (!_deadlines.empty()) {
+                    std::pop_heap(_deadlines.begin(), _deadlines.end(), later);
+                    entry = std::move(_deadlines.back().entry);
+                    _deadlines.pop_back();
+                    band = _bands.size();
+                } else {
+                    band = pickBand(now, 0u == ++_picks % kAgingShare);
+                    if (band == _bands.size()) {
+                        return false;
+                    }
+                    entry = _bands[band].popFront();
+                }
+            }
+            _size.fetch_sub(1, std::memory_order_relaxed);
+            _counters[band].depth.fetch_sub(1, std::memory_order_relaxed);
+            _counters[band].waitTime.record(now - entry.enqueued);
+            task = std::move(entry.task);
+            return true;
+        }
+
+    private:
+        static constexpr unsigned kAgingShare = 8;
+
+        struct Entry {
+            TaskWrapper task;
+            Clock::time_point enqueued;
+        };
+
+        struct DeadlineEntry {
+            Clock::time_point deadline;
+            uint64_t sequence;
+            Entry entry;
+        };
+
+        static bool later(const DeadlineEntry& a, const DeadlineEntry& b) {
+            return a.deadline != b.deadline ? a.deadline > b.deadline
+                                            : a.sequence > b.sequence;
+        }
+
+        size_t pickBand(Clock::time_point now, bool withAging) const {
+            auto best = _bands.size();
+            std::ptrdiff_t bestLevel = 0;
+            for (size_t band = 0; band < _bands.size(); ++band) {
+                if (_bands[band].empty()) {
+                    continue;
+                }
+                if (!withAging) {
+                    return band;
+                }
+                const auto aged =
+                    (now - _bands[band].front().enqueued) / _agingInterval;
+                const auto level = static_cast<std::ptrdiff_t>(band) -
+                                   static_cast<std::ptrdiff_t>(aged);
+                if (best == _bands.size() || level < bestLevel) {
+                    best = band;
+                    bestLevel = level;
+                }
+            }
+            return best;
+        }
+
+        std::mutex _m;
+        std::vector<RingDeque<Entry>> _bands;
+        std::vector<DeadlineEntry> _deadlines;
+        uint64_t _sequence = 0;
+        unsigned _picks = 0;
+        // One entry per band plus a last one for the deadline band.
+        std::vector<BandCounters> _counters;
+        Clock::duration _agingInterval;
+        std::atomic<size_t> _size{0};
+    };
+
+    // NUMA nodes and the CPUs of each that this process may run on, read
+    // from sysfs. Anything that cannot be read collapses to a single node
+    // holding every allowed CPU.
+    struct Topology {
+        std::vector<std::vector<int>> nodes;
+        // Node index for each CPU number, for mapping sched_getcpu().
+        std::vector<size_t> nodeOfCpu;
 
-        auto operator()() { impl->call(); }
+        static Topology detect() {
+            Topology topology;
+            const auto allowed = allowedCpus();
+#if defined(__linux__)
+            const std::string root = "/sys/devices/system/node/";
+            for (const auto node : parseCpuList(readLine(root + "online"))) {
+                std::vector<int> cpus;
+                for (const auto cpu : parseCpuList(readLine(
+                         root + "node" + std::to_string(node) + "/cpulist"))) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) !=
+                        allowed.end()) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty()) {
+                    topology.nodes.push_back(std::move(cpus));
+                }
+            }
+#endif
+            if (topology.nodes.empty()) {
+                topology.nodes.push_back(allowed);
+            }
+            for (size_t node = 0; node < topology.nodes.size(); ++node) {
+                for (const auto cpu : topology.nodes[node]) {
+                    const auto index = static_cast<size_t>(cpu);
+                    if (topology.nodeOfCpu.size() <= index) {
+                        topology.nodeOfCpu.resize(index + 1, 0);
+                    }
+                    topology.nodeOfCpu[index] = node;
+                }
+            }
+            return topology;
+        }
+
+        // Parses the kernel's list format, e.g. "0-3,8-11".
+        static std::vector<int> parseCpuList(const std::string& list) {
+            std::vector<int> cpus;
+            size_t pos = 0;
+            while (pos < list.size()) {
+                auto end = list.find(',', pos);
+                if (std::string::npos == end) {
+                    end = list.size();
+                }
+                const auto range = list.substr(pos, end - pos);
+                const auto dash = range.find('-');
+                try {
+                    const auto first = std::stoi(range.substr(0, dash));
+                    const auto last = std::string::npos == dash
+                                          ? first
+                                          : std::stoi(range.substr(dash + 1));
+                    for (auto cpu = first; cpu <= last; ++cpu) {
+                        cpus.push_back(cpu);
+                    }
+                } catch (const std::exception&) {
+                    // A malformed entry is skipped, not fatal.
+                }
+                pos = end + 1;
+            }
+            return cpus;
+        }
+
+    private:
+        static std::string readLine(const std::string& path) {
+            std::ifstream in{path};
+            std::string line;
+            std::getline(in, line);
+            return line;
+        }
+
+        static std::vector<int> allowedCpus() {
+            std::vector<int> cpus;
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (0 == sched_getaffinity(0, sizeof(set), &set)) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &set)) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            if (cpus.empty()) {
+                const auto count =
+                    std::max(1u, std::thread::hardware_concurrency());
+                for (unsigned cpu = 0; cpu < count; ++cpu) {
+                    cpus.push_back(static_cast<int>(cpu));
+                }
+            }
+            return cpus;
+        }
     };
 
     class JoinThreads {
@@ -67,7 +646,9 @@ private:
 
         ~JoinThreads() {
             for (auto& t : _threads) {
-                t.join();
+                if (t.joinable()) {
+                    t.join();
+                }
             }
         }
 
@@ -76,77 +657,1835 @@ private:
     };
 
 public:
+    enum class Scheduling {
+        // Every task goes through one shared queue.
+        GlobalQueue,
+        // Tasks submitted from a worker go to that worker's own deque and
+        // idle workers steal from the others; external submits still use the
+        // shared queue.
+        WorkStealing
+    };
+
+    enum class QueueBackend {
+        // Growable ring guarded by a mutex.
+        Mutex,
+        // Bounded lock-free ring; pushes that find it full spill into the
+        // mutex queue rather than block the submitter.
+        LockFree
+    };
+
+    struct Options {
+        size_t threadCount = std::thread::hardware_concurrency();
+        Scheduling scheduling = Scheduling::GlobalQueue;
+        QueueBackend queueBackend = QueueBackend::Mutex;
+        // Ring size for QueueBackend::LockFree, rounded up to a power of two.
+        size_t queueCapacity = 4096;
+        // Bands for submit_with_priority(); level 0 is the most urgent.
+        size_t priorityBands = 3;
+        // In the share of picks that honour aging, a prioritized task that
+        // has waited this long competes as if it were one band higher, and
+        // so on for every further interval.
+        std::chrono::steady_clock::duration agingInterval =
+            std::chrono::milliseconds{10};
+        // Workers are spread round-robin over the NUMA nodes. With this set
+        // each one is also pinned to a single core of its node.
+        bool pinThreads = false;
+        // Give every NUMA node its own shared queue (capped at one per
+        // worker) and bind workers to their node's cores. Workers drain
+        // their node's queue and steal from same-node workers before
+        // reaching across nodes. Queues are allocated by a worker of the
+        // node they serve, so first-touch places them in its memory.
+        bool numaQueues = false;
+        // Upper bound for resize() and elastic growth; 0 means
+        // max(threadCount, hardware_concurrency()).
+        size_t maxThreads = 0;
+        // Elastic mode: a worker that stays parked for idleTimeout retires
+        // one worker (never going below minThreads), and a submit that finds
+        // no parked worker and at least growBacklog queued tasks per worker
+        // starts another one, up to maxThreads.
+        bool elastic = false;
+        size_t minThreads = 1;
+        std::chrono::steady_clock::duration idleTimeout =
+            std::chrono::seconds{1};
+        size_t growBacklog = 4;
+        // Measure queue wait, execution, busy and idle time for stats().
+        // Costs a few clock reads per task.
+        bool recordTimings = false;
+        // Keep the first traceCapacity task spans of every worker for
+        // writeChromeTrace(). Implies recordTimings.
+        size_t traceCapacity = 0;
+    };
+
+    enum class ShutdownMode {
+        // Run every queued task, including the ones they submit in turn,
+        // then stop.
+        Drain,
+        // Stop once the running tasks return. Queued tasks are destroyed
+        // unrun, so their futures report broken_promise.
+        Abandon
+    };
+
+    struct BandStats {
+        size_t depth = 0;
+        LatencyHistogram::Snapshot waitTime;
+    };
+
+    // Counters of one worker slot. Times and histograms stay empty unless
+    // Options::recordTimings is set.
+    struct WorkerStats {
+        uint64_t tasks = 0;
+        uint64_t steals = 0;
+        std::chrono::nanoseconds busy{0};
+        std::chrono::nanoseconds idle{0};
+        LatencyHistogram::Snapshot queueWait;
+        LatencyHistogram::Snapshot execution;
+
+        WorkerStats& operator+=(const WorkerStats& other) {
+            tasks += other.tasks;
+            steals += other.steals;
+            busy += other.busy;
+            idle += other.idle;
+            queueWait += other.queueWait;
+            execution += other.execution;
+            return *this;
+        }
+    };
+
+    struct Stats {
+        // One entry per worker slot that has ever run.
+        std::vector<WorkerStats> workers;
+        WorkerStats total;
+        size_t queueSize = 0;
+        // Highest number of queued tasks seen since construction.
+        size_t maxQueueDepth = 0;
+    };
+
+    static constexpr size_t kTaskInlineSize = THREAD_POOL_TASK_INLINE_SIZE;
+
     explicit ThreadPool(
-        size_t threadCount = std::thread::hardware_concurrency())
-        : _done{false}, _joiner{_threads} {
+        size_t threadCount = std::thread::hardware_concurrency(),
+        Scheduling scheduling = Scheduling::GlobalQueue)
+        : ThreadPool{makeOptions(threadCount, scheduling)} {}
+
+    explicit ThreadPool(const Options& options)
+        : _done{false},
+          _priority{options.priorityBands, options.agingInterval},
+          _joiner{_threads} {
+        auto threadCount = options.threadCount;
         if (0u == threadCount) {
             threadCount = 1u;
         }
-        _threads.reserve(threadCount);
+        if (QueueBackend::LockFree == options.queueBackend) {
+            _ringCapacity = options.queueCapacity;
+        }
+        const auto maxThreads = std::max(
+            threadCount,
+            0u == options.maxThreads
+                ? size_t{std::thread::hardware_concurrency()}
+                : options.maxThreads);
+        _recordTimings = options.recordTimings || 0u != options.traceCapacity;
+        _epochNs = nowNs();
+        _workerCounters = std::make_unique<WorkerCounters[]>(maxThreads);
+        if (0u != options.traceCapacity) {
+            for (size_t i = 0; i < maxThreads; ++i) {
+                _workerCounters[i].trace =
+                    std::make_unique<TraceSpan[]>(options.traceCapacity);
+                _workerCounters[i].traceCapacity = options.traceCapacity;
+            }
+        }
+        _elastic = options.elastic;
+        _minThreads = std::clamp<size_t>(options.minThreads, 1u, threadCount);
+        _idleTimeout = options.idleTimeout;
+        _growBacklog = std::max<size_t>(1u, options.growBacklog);
+        // Queues are built by the workers once they run where they belong;
+        // the slots exist up front so nothing reallocates under a reader.
+        const auto topology = Topology::detect();
+        const auto groups = std::min(topology.nodes.size(), threadCount);
+        _nodes.resize(options.numaQueues ? groups : 1u);
+        if (_nodes.size() > 1u) {
+            // With fewer workers than nodes, the nodes past the last group
+            // share the groups' queues.
+            _cpuNode = topology.nodeOfCpu;
+            for (auto& node : _cpuNode) {
+                node %= _nodes.size();
+            }
+        }
+        if (Scheduling::WorkStealing == options.scheduling) {
+            // Slots beyond the initial workers get their deques now, since
+            // thieves may already be scanning by the time they start.
+            _localQueues.resize(maxThreads);
+            for (size_t i = threadCount; i < maxThreads; ++i) {
+                _localQueues[i] = std::make_unique<WorkStealingQueue>();
+            }
+        }
+        _workers.resize(maxThreads);
+        for (size_t i = 0; i < maxThreads; ++i) {
+            const auto& cpus = topology.nodes[i % groups];
+            auto& worker = _workers[i];
+            worker.node = options.numaQueues ? i % groups : 0u;
+            if (options.pinThreads) {
+                worker.cpus = {cpus[(i / groups) % cpus.size()]};
+            } else if (options.numaQueues && groups > 1u) {
+                worker.cpus = cpus;
+            }
+        }
+        _threads.resize(maxThreads);
+        _initialThreads = threadCount;
+        _target = threadCount;
         try {
+            std::lock_guard<std::mutex> l{_resizeMutex};
             for (size_t i = 0; i < threadCount; ++i) {
-                _threads.emplace_back(&ThreadPool::workerThread, this);
+                startWorker(i);
             }
         } catch (...) {
-            _done = true;
-            _queue.cv.notify_all();
+            stop();
             throw;
         }
+        std::unique_lock<std::mutex> l{_wake.m};
+        _wake.cv.wait(l, [&] { return _ready == threadCount; });
     }
 
-    ~ThreadPool() {
-        _done = true;
-        _queue.cv.notify_all();
+    // Drains the queues first; see shutdown().
+    ~ThreadPool() { shutdown(ShutdownMode::Drain); }
+
+    // Stops the pool and joins its workers. Submitting from outside the pool
+    // afterwards throws std::runtime_error. Later calls do nothing. Must not
+    // be called from one of the pool's own tasks.
+    void shutdown(ShutdownMode mode = ShutdownMode::Drain) {
+        {
+            std::lock_guard<std::mutex> l{_resizeMutex};
+            if (_stopping) {
+                return;
+            }
+            _stopping = true;
+        }
+        if (ShutdownMode::Drain == mode) {
+            // Nothing is queued and every worker is parked, so nothing is
+            // running that could submit more.
+            std::unique_lock<std::mutex> l{_wake.m};
+            _draining = true;
+            _wake.drained.wait(l, [&] {
+                return 0u == pending() &&
+                       _sleepers.load() == _live.load();
+            });
+        }
+        stop();
+        for (auto& t : _threads) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+        // Whatever is left was abandoned; each pop destroys the previous one.
+        TaskWrapper task;
+        while (tryPop(task)) {
+        }
     }
 
-    size_t capacity() const { return _threads.size(); }
-    size_t queueSize() const {
-        std::unique_lock<std::mutex> l{_queue.m};
-        return _queue.q.size();
+    // Sets the number of workers, clamped to [1, Options::maxThreads].
+    // Growing starts workers right away. Surplus workers retire once their
+    // current task returns and hand their queued tasks to the shared queue.
+    // In elastic mode this only moves the starting point.
+    void resize(size_t threadCount) {
+        std::lock_guard<std::mutex> l{_resizeMutex};
+        if (!_stopping) {
+            setTarget(threadCount);
+        }
     }
 
+    size_t capacity() const { return _target.load(std::memory_order_relaxed); }
+    size_t maxCapacity() const { return _workers.size(); }
+    // Number of per-node queues; 1 unless Options::numaQueues found several
+    // NUMA nodes.
+    size_t nodeCount() const { return _nodes.size(); }
+    size_t queueSize() const { return pending(std::memory_order_relaxed); }
+
     template <typename FunctionT, typename... Args>
     auto submit(FunctionT f, Args... args) {
-        using ResultT = typename std::result_of<FunctionT(Args...)>::type;
-        std::packaged_task<ResultT()> task{std::bind(f, args...)};
+        auto task = package(std::move(f), std::move(args)...);
         auto future = task.get_future();
-        {
-            std::lock_guard<std::mutex> l{_queue.m};
-            _queue.q.push(std::move(task));
-        }
-        _queue.cv.notify_all();
+        push(std::move(task));
+        return future;
+    }
+
+    // Queues the task in priority band `level` (0 is the most urgent; levels
+    // past the last band are clamped). Prioritized tasks run before plain
+    // submit() work, except that every few picks a worker serves the plain
+    // queues first so they cannot starve. Waiting tasks age into higher
+    // bands, see Options::agingInterval.
+    template <typename FunctionT, typename... Args>
+    auto submit_with_priority(size_t level, FunctionT f, Args... args) {
+        throwIfStopped();
+        auto task = package(std::move(f), std::move(args)...);
+        auto future = task.get_future();
+        _priority.push(level, stamped(std::move(task)));
+        enqueued(1);
+        return future;
+    }
+
+    // Like submit(), but queues the task on the given NUMA node (taken modulo
+    // nodeCount()) so one of that node's workers picks it up first. Other
+    // nodes only get it by stealing once they run dry.
+    template <typename FunctionT, typename... Args>
+    auto submit_to_node(size_t node, FunctionT f, Args... args) {
+        throwIfStopped();
+        auto task = package(std::move(f), std::move(args)...);
+        auto future = task.get_future();
+        pushToNode(node % _nodes.size(), stamped(std::move(task)));
+        enqueued(1);
+        return future;
+    }
+
+    // Queues the task in the deadline band, which is served earliest deadline
+    // first and ahead of every priority band.
+    template <typename FunctionT, typename... Args>
+    auto submit_with_deadline(std::chrono::steady_clock::time_point deadline,
+                              FunctionT f, Args... args) {
+        throwIfStopped();
+        auto task = package(std::move(f), std::move(args)...);
+        auto future = task.get_future();
+        _priority.pushDeadline(deadline, stamped(std::move(task)));
+        enqueued(1);
         return future;
     }
 
+    // Queue depth and wait-time histogram of every priority band (index =
+    // level), followed by the deadline band.
+    // Aggregates the per-worker counters with relaxed loads while the pool
+    // keeps running, so the totals may be a few tasks apart from each
+    // other. Tasks run by threads outside the pool (helping in
+    // parallel_for() or Future::get()) are not counted.
+    Stats stats() const {
+        Stats result;
+        result.queueSize = queueSize();
+        result.maxQueueDepth = _maxPending.load(std::memory_order_relaxed);
+        result.workers.resize(_slotsUsed.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < result.workers.size(); ++i) {
+            const auto& counters = _workerCounters[i];
+            auto& worker = result.workers[i];
+            worker.tasks = counters.tasks.load(std::memory_order_relaxed);
+            worker.steals = counters.steals.load(std::memory_order_relaxed);
+            worker.busy = std::chrono::nanoseconds{
+                counters.busyNs.load(std::memory_order_relaxed)};
+            worker.idle = std::chrono::nanoseconds{
+                counters.idleNs.load(std::memory_order_relaxed)};
+            worker.queueWait = counters.queueWait.snapshot();
+            worker.execution = counters.execution.snapshot();
+            result.total += worker;
+        }
+        return result;
+    }
+
+    // Writes the recorded task spans (see Options::traceCapacity) in the
+    // Chrome trace event format, one track per worker, for chrome://tracing
+    // or Perfetto. Safe to call while the pool runs; spans recorded after a
+    // worker's buffer filled up are dropped.
+    void writeChromeTrace(std::ostream& out) const {
+        out << "{\"traceEvents\":[";
+        const char* separator = "\n";
+        const auto slots = _slotsUsed.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < slots; ++i) {
+            const auto& counters = _workerCounters[i];
+            out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\","
+                << "\"pid\":1,\"tid\":" << i
+                << ",\"args\":{\"name\":\"worker " << i << "\"}}";
+            separator = ",\n";
+            const auto spans =
+                counters.traceSize.load(std::memory_order_acquire);
+            for (size_t s = 0; s < spans; ++s) {
+                const auto& span = counters.trace[s];
+                out << separator << "{\"name\":\"task\",\"ph\":\"X\","
+                    << "\"pid\":1,\"tid\":" << i << ",\"ts\":";
+                writeMicros(out, span.begin - _epochNs);
+                out << ",\"dur\":";
+                writeMicros(out, span.end - span.begin);
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    std::vector<BandStats> priorityStats() const {
+        std::vector<BandStats> stats(_priority.bands() + 1);
+        for (size_t band = 0; band < stats.size(); ++band) {
+            const auto& counters = _priority.counters(band);
+            stats[band].depth = counters.depth.load(std::memory_order_relaxed);
+            stats[band].waitTime = counters.waitTime.snapshot();
+        }
+        return stats;
+    }
+
+    // Fire-and-forget submit: no future and no shared state, so a task whose
+    // captures fit in THREAD_POOL_TASK_INLINE_SIZE costs no allocation.
+    // An exception escaping the task terminates the program, as it would for
+    // a std::thread.
+    template <typename FunctionT, typename... Args>
+    void submit_detached(FunctionT f, Args... args) {
+        if constexpr (0u == sizeof...(Args)) {
+            push(std::move(f));
+        } else {
+            push([f = std::move(f), args...]() mutable {
+                std::invoke(f, args...);
+            });
+        }
+    }
+
+    // Enqueues every callable in [first, last) as a detached task, taking the
+    // queue lock once and waking at most as many workers as there are tasks.
+    // Elements are copied; pass move iterators to move them instead.
+    template <typename Iterator>
+    void submit_bulk(Iterator first, Iterator last) {
+        throwIfStopped();
+        size_t count = 0;
+        const auto enqueuedAt = timestamp();
+        if (isLocalWorker()) {
+            count = _localQueue->pushBulk(first, last, enqueuedAt);
+        } else {
+            auto& node = *_nodes[homeNode()];
+            for (; first != last && node.ring; ++first, ++count) {
+                TaskWrapper task{*first};
+                task.setEnqueuedAt(enqueuedAt);
+                if (!node.ring->tryPush(task)) {
+                    count += pushGlobalBulk(node,
+                                            std::make_move_iterator(&task),
+                                            std::make_move_iterator(&task + 1),
+                                            enqueuedAt);
+                    ++first;
+                    break;
+                }
+            }
+            count += pushGlobalBulk(node, first, last, enqueuedAt);
+        }
+        if (0u != count) {
+            enqueued(count);
+        }
+    }
+
+    // Calls fn(i) for every i in [first, last), or fn(begin, end) once per
+    // chunk if fn takes two indices. The range is cut into chunks of `grain`
+    // indices (0 picks a grain from the pool size) that workers claim one at
+    // a time, so uneven chunks balance themselves. The calling thread works
+    // on chunks too and then runs other queued tasks until the loop is done.
+    // The first exception thrown by fn is rethrown here.
+    template <typename IndexT, typename FunctionT>
+    void parallel_for(IndexT first, IndexT last, size_t grain, FunctionT&& fn) {
+        if (!(first < last)) {
+            return;
+        }
+        const auto count = static_cast<size_t>(last - first);
+        grain = chooseGrain(count, grain);
+        runChunks((count + grain - 1) / grain, [&](size_t chunk) {
+            const auto begin = first + static_cast<IndexT>(chunk * grain);
+            const auto end = first + static_cast<IndexT>(
+                                         std::min(count, (chunk + 1) * grain));
+            if constexpr (std::is_invocable_v<FunctionT&, IndexT, IndexT>) {
+                fn(begin, end);
+            } else {
+                for (auto i = begin; i != end; ++i) {
+                    fn(i);
+                }
+            }
+        });
+    }
+
+    // Folds combine(acc, fn(i)) over [first, last) starting from `identity`.
+    // Chunks are reduced in parallel and their partial results combined in
+    // index order, so combine only needs to be associative.
+    template <typename IndexT, typename T, typename FunctionT,
+              typename CombineT>
+    T parallel_reduce(IndexT first, IndexT last, size_t grain, T identity,
+                      FunctionT&& fn, CombineT&& combine) {
+        if (!(first < last)) {
+            return identity;
+        }
+        const auto count = static_cast<size_t>(last - first);
+        grain = chooseGrain(count, grain);
+        const auto chunks = (count + grain - 1) / grain;
+        std::vector<T> partials(chunks, identity);
+        runChunks(chunks, [&](size_t chunk) {
+            const auto begin = first + static_cast<IndexT>(chunk * grain);
+            const auto end = first + static_cast<IndexT>(
+                                         std::min(count, (chunk + 1) * grain));
+            auto acc = identity;
+            for (auto i = begin; i != end; ++i) {
+                acc = combine(std::move(acc), fn(i));
+            }
+            partials[chunk] = std::move(acc);
+        });
+        auto result = std::move(identity);
+        for (auto& partial : partials) {
+            result = combine(std::move(result), std::move(partial));
+        }
+        return result;
+    }
+
+    // Like submit(), but returns a pool-aware Future. Continuations attached
+    // with Future::then(), when_all() or when_any() are queued on this pool
+    // the moment their inputs are ready, so no thread has to block in
+    // between. The task, its result and its continuation link share one
+    // allocation.
+    template <typename FunctionT, typename... Args>
+    auto async(FunctionT f, Args... args)
+        -> Future<std::invoke_result_t<FunctionT&, Args&...>>;
+
+    // Awaitable that moves the awaiting coroutine onto one of this pool's
+    // workers: `co_await pool.schedule();`.
+    auto schedule() {
+        struct Awaiter {
+            ThreadPool& pool;
+
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) {
+                pool.push([handle] { handle.resume(); });
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    // Runs the task on this pool without anyone awaiting it, e.g. one per
+    // incoming request. An exception escaping the task terminates the
+    // program, as for submit_detached().
+    template <typename T>
+    void spawn(Task<T> task);
+
     ThreadPool(const ThreadPool&) = delete;
     ThreadPool(ThreadPool&) = delete;
     ThreadPool& operator=(const ThreadPool&) = delete;
 
 private:
-    void workerThread() {
-        while (!_done) {
-            std::unique_lock<std::mutex> l{_queue.m};
-            _queue.cv.wait(l, [&] { return !_queue.q.empty() || _done; });
-            if (_done) {
-                break;
+    friend class detail::FutureStateBase;
+
+    // Number of empty polls a worker makes before it parks on the condition
+    // variable. Keeps short gaps between tasks from costing a futex round trip.
+    static constexpr unsigned kSpinCount = 64;
+
+    // Every kFairnessInterval-th pick a worker tries the plain queues before
+    // the prioritized ones.
+    static constexpr unsigned kFairnessInterval = 16;
+
+    template <typename FunctionT, typename... Args>
+    static auto package(FunctionT f, Args... args) {
+        using ResultT = std::invoke_result_t<FunctionT&, Args&...>;
+        return std::packaged_task<ResultT()>{
+            [f = std::move(f), args...]() mutable {
+                return std::invoke(f, args...);
+            }};
+    }
+
+    static Options makeOptions(size_t threadCount, Scheduling scheduling) {
+        Options options;
+        options.threadCount = threadCount;
+        options.scheduling = scheduling;
+        return options;
+    }
+
+    bool isLocalWorker() const { return _localQueue && this == _localPool; }
+    bool isWorkerThread() const { return this == _localPool; }
+
+    struct NodeQueue;
+    struct WorkerCounters;
+
+    // The node whose queue a push from outside the local deque goes to: the
+    // worker's own, or the one the calling thread currently runs on.
+    size_t homeNode() const {
+        if (isWorkerThread()) {
+            return _localNode;
+        }
+#if defined(__linux__)
+        if (!_cpuNode.empty()) {
+            const auto cpu = sched_getcpu();
+            if (cpu >= 0 && static_cast<size_t>(cpu) < _cpuNode.size()) {
+                return _cpuNode[static_cast<size_t>(cpu)];
             }
-            auto task = std::move(_queue.q.front());
-            _queue.q.pop();
-            l.unlock();
-            task();
         }
+#endif
+        return 0;
     }
 
-    struct TaskQueue {
-        std::queue<TaskWrapper> q;
-        std::mutex m;
-        std::condition_variable cv;
-    };
+    template <typename Iterator>
+    static size_t pushGlobalBulk(NodeQueue& node, Iterator first,
+                                 Iterator last, int64_t enqueuedAt) {
+        if (first == last) {
+            return 0;
+        }
+        size_t count = 0;
+        std::lock_guard<std::mutex> l{node.queue.m};
+        for (; first != last; ++first, ++count) {
+            TaskWrapper task{*first};
+            task.setEnqueuedAt(enqueuedAt);
+            node.queue.q.pushBack(std::move(task));
+        }
+        node.queue.size.fetch_add(count, std::memory_order_relaxed);
+        return count;
+    }
+
+    void pushToNode(size_t index, TaskWrapper task) {
+        auto& node = *_nodes[index];
+        if (!node.ring || !node.ring->tryPush(task)) {
+            std::lock_guard<std::mutex> l{node.queue.m};
+            node.queue.q.pushBack(std::move(task));
+            node.queue.size.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Tasks of a stopping pool may still submit; their work is discarded
+    // with the rest of the queue.
+    void throwIfStopped() const {
+        if (_done.load(std::memory_order_relaxed) && !isWorkerThread()) {
+            throw std::runtime_error{"ThreadPool: submit after shutdown"};
+        }
+    }
+
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Enqueue stamp for a task; 0 (no clock read) unless timings are on.
+    int64_t timestamp() const { return _recordTimings ? nowNs() : 0; }
+
+    TaskWrapper stamped(TaskWrapper task) const {
+        task.setEnqueuedAt(timestamp());
+        return task;
+    }
+
+    // Writes nanoseconds as microseconds with three decimals, without
+    // touching the stream's formatting state.
+    static void writeMicros(std::ostream& out, int64_t ns) {
+        const auto fraction = ns % 1000;
+        out << ns / 1000 << '.' << static_cast<char>('0' + fraction / 100)
+            << static_cast<char>('0' + fraction / 10 % 10)
+            << static_cast<char>('0' + fraction % 10);
+    }
+
+    // `_pending` is counted after a task is published, so a worker that pops
+    // it first can take the counter briefly below zero; read it through this.
+    size_t pending(
+        std::memory_order order = std::memory_order_seq_cst) const {
+        return static_cast<size_t>(
+            std::max<std::ptrdiff_t>(0, _pending.load(order)));
+    }
+
+    // Accounts for `count` newly queued tasks and wakes workers for them.
+    void enqueued(size_t count) {
+        const auto added = static_cast<std::ptrdiff_t>(count);
+        const auto depth = static_cast<size_t>(
+            std::max<std::ptrdiff_t>(0, _pending.fetch_add(added) + added));
+        auto highest = _maxPending.load(std::memory_order_relaxed);
+        while (depth > highest &&
+               !_maxPending.compare_exchange_weak(highest, depth,
+                                                  std::memory_order_relaxed)) {
+        }
+        wake(count);
+    }
+
+    void push(TaskWrapper task) {
+        throwIfStopped();
+        if (isLocalWorker()) {
+            _localQueue->push(stamped(std::move(task)));
+        } else {
+            pushToNode(homeNode(), stamped(std::move(task)));
+        }
+        enqueued(1);
+    }
+
+    bool tryPopLocal(TaskWrapper& task) {
+        return isLocalWorker() && _localQueue->tryPop(task);
+    }
+
+    static bool tryPopNode(NodeQueue& node, TaskWrapper& task) {
+        if (node.ring && node.ring->tryPop(task)) {
+            return true;
+        }
+        if (0u == node.queue.size.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> l{node.queue.m};
+        if (node.queue.q.empty()) {
+            return false;
+        }
+        task = node.queue.q.popFront();
+        node.queue.size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Home node first, then the others.
+    bool tryPopGlobal(TaskWrapper& task) {
+        const auto home = homeNode();
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            if (tryPopNode(*_nodes[(home + i) % _nodes.size()], task)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Victims on the thief's own node are tried before remote ones.
+    bool trySteal(TaskWrapper& task) {
+        // Slots that never ran a worker have nothing to steal.
+        const auto n = _localQueues.empty()
+                           ? size_t{0}
+                           : _slotsUsed.load(std::memory_order_relaxed);
+        const bool byNode = _nodes.size() > 1u;
+        // A worker skips its own deque; any other thread probes them all.
+        const size_t first = isWorkerThread() ? 1 : 0;
+        for (int pass = 0; pass < (byNode ? 2 : 1); ++pass) {
+            for (size_t i = first; i < n; ++i) {
+                const auto victim = (_localIndex + i) % n;
+                if (byNode &&
+                    (_workers[victim].node == _localNode) != (0 == pass)) {
+                    continue;
+                }
+                if (_localQueues[victim]->trySteal(task)) {
+                    if (isWorkerThread()) {
+                        bump(_workerCounters[_localIndex].steals, 1);
+                    }
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool tryPopRegular(TaskWrapper& task) {
+        return tryPopLocal(task) || tryPopGlobal(task) || trySteal(task);
+    }
+
+    bool tryPop(TaskWrapper& task) {
+        const bool regularFirst = 0u == ++_pickCount % kFairnessInterval;
+        if ((!regularFirst && _priority.tryPop(task)) || tryPopRegular(task) ||
+            (regularFirst && _priority.tryPop(task))) {
+            _pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    // Wakes up to `count` parked workers. `_sleepers` is incremented before a
+    // worker re-checks `_pending` under `_wake.m`, so either the worker sees
+    // the new task or we see the sleeper and notify it.
+    void wake(size_t count) {
+        const auto sleepers = _sleepers.load();
+        if (0u == sleepers) {
+            growForBacklog();
+            return;
+        }
+        { std::lock_guard<std::mutex> l{_wake.m}; }
+        if (count >= sleepers) {
+            _wake.cv.notify_all();
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                _wake.cv.notify_one();
+            }
+        }
+    }
+
+    bool tryRunPendingTask() {
+        TaskWrapper task;
+        if (!tryPop(task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+    size_t chooseGrain(size_t count, size_t grain) const {
+        if (0u != grain) {
+            return grain;
+        }
+        // A few chunks per worker leaves room for balancing without making
+        // the claim counter the bottleneck.
+        return std::max<size_t>(1u, count / (8u * capacity()));
+    }
+
+    // Shared by the helpers of one parallel loop. Helpers that start after
+    // the loop finished find no chunk left and never touch `body`.
+    struct ChunkLoop {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> finished{0};
+        size_t chunks = 0;
+        void* body = nullptr;
+        void (*runChunk)(void* body, size_t chunk) = nullptr;
+        // Once a chunk throws, the remaining chunks are claimed but skipped.
+        std::atomic_bool failed{false};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        void work() {
+            for (auto chunk = next.fetch_add(1); chunk < chunks;
+                 chunk = next.fetch_add(1)) {
+                if (!failed.load(std::memory_order_relaxed)) {
+                    try {
+                        runChunk(body, chunk);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> l{errorMutex};
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        failed = true;
+                    }
+                }
+                finished.fetch_add(1, std::memory_order_release);
+            }
+        }
+    };
+
+    template <typename BodyT>
+    void runChunks(size_t chunks, BodyT&& body) {
+        auto loop = std::make_shared<ChunkLoop>();
+        loop->chunks = chunks;
+        loop->body = &body;
+        loop->runChunk = [](void* b, size_t chunk) {
+            (*static_cast<std::remove_reference_t<BodyT>*>(b))(chunk);
+        };
+        const auto helpers = std::min(chunks - 1, capacity());
+        if (0u != helpers) {
+            auto helper = [loop] { loop->work(); };
+            const std::vector<decltype(helper)> helperTasks(helpers, helper);
+            submit_bulk(helperTasks.begin(), helperTasks.end());
+        }
+        loop->work();
+        while (loop->finished.load(std::memory_order_acquire) < chunks) {
+            if (!tryRunPendingTask()) {
+                std::this_thread::yield();
+            }
+        }
+        if (loop->failed) {
+            std::exception_ptr error;
+            {
+                std::lock_guard<std::mutex> l{loop->errorMutex};
+                error = std::move(loop->error);
+            }
+            std::rethrow_exception(std::move(error));
+        }
+    }
+
+    bool surplus(size_t index) const {
+        return index >= _target.load(std::memory_order_relaxed);
+    }
+
+    // Returns true if an elastic worker stayed parked for the whole idle
+    // timeout.
+    bool waitForTask(size_t index) {
+        for (unsigned i = 0; i < kSpinCount; ++i) {
+            if (0u != pending(std::memory_order_relaxed) || _done) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> l{_wake.m};
+        _sleepers.fetch_add(1);
+        if (_draining) {
+            _wake.drained.notify_all();
+        }
+        const auto ready = [&] {
+            return 0u != pending() || _done || surplus(index);
+        };
+        bool timedOut = false;
+        if (_elastic) {
+            timedOut = !_wake.cv.wait_for(l, _idleTimeout, ready);
+        } else {
+            _wake.cv.wait(l, ready);
+        }
+        _sleepers.fetch_sub(1);
+        return timedOut;
+    }
+
+    // Called with _resizeMutex held. Starts the missing workers below the
+    // new target and wakes parked ones above it so they retire.
+    void setTarget(size_t threadCount) {
+        threadCount = std::clamp<size_t>(threadCount, 1u, _workers.size());
+        const auto previous = _target.exchange(threadCount);
+        for (size_t i = 0; i < threadCount; ++i) {
+            if (!_workers[i].running) {
+                startWorker(i);
+            }
+        }
+        if (threadCount < previous) {
+            { std::lock_guard<std::mutex> l{_wake.m}; }
+            _wake.cv.notify_all();
+        }
+    }
+
+    // Called with _resizeMutex held. A slot's previous thread has already
+    // decided to retire, so joining it only waits for it to finish exiting.
+    void startWorker(size_t index) {
+        if (_threads[index].joinable()) {
+            _threads[index].join();
+        }
+        _threads[index] = std::thread{&ThreadPool::workerThread, this, index};
+        _workers[index].running = true;
+        _live.fetch_add(1);
+        if (_slotsUsed.load(std::memory_order_relaxed) <= index) {
+            _slotsUsed.store(index + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // A worker above the target leaves unless the target moved back up in
+    // the meantime. A draining shutdown() counts on it to leave, since a
+    // surplus worker never parks.
+    bool tryRetire(size_t index) {
+        std::lock_guard<std::mutex> l{_resizeMutex};
+        if (!surplus(index)) {
+            return false;
+        }
+        _workers[index].running = false;
+        _live.fetch_sub(1);
+        { std::lock_guard<std::mutex> w{_wake.m}; }
+        _wake.drained.notify_all();
+        return true;
+    }
+
+    // Elastic mode: a worker parked for a whole idle timeout gives up one
+    // slot. The top worker is the one that retires, which may not be the
+    // idle one.
+    void shrinkIdle(size_t index) {
+        std::lock_guard<std::mutex> l{_resizeMutex};
+        const auto target = _target.load();
+        if (_stopping || target <= _minThreads) {
+            return;
+        }
+        _target.store(target - 1);
+        if (index != target - 1) {
+            { std::lock_guard<std::mutex> w{_wake.m}; }
+            _wake.cv.notify_all();
+        }
+    }
+
+    // Elastic mode: called when a submit found no parked worker. Never
+    // blocks the submitter; if someone else is resizing, it is left to them.
+    void growForBacklog() {
+        if (!_elastic) {
+            return;
+        }
+        const auto target = _target.load(std::memory_order_relaxed);
+        if (target >= _workers.size() ||
+            pending(std::memory_order_relaxed) < target * _growBacklog) {
+            return;
+        }
+        std::unique_lock<std::mutex> l{_resizeMutex, std::try_to_lock};
+        if (!l.owns_lock() || _stopping || _target.load() != target) {
+            return;
+        }
+        try {
+            setTarget(target + 1);
+        } catch (const std::system_error&) {
+            // Out of threads: carry on with the workers there are.
+        }
+    }
+
+    // Restricts the calling thread to `cpus`. Best effort: on failure the
+    // thread stays wherever the scheduler puts it.
+    static void bindToCpus(const std::vector<int>& cpus) {
+#if defined(__linux__)
+        if (cpus.empty()) {
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const auto cpu : cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+#else
+        (void)cpus;
+#endif
+    }
+
+    // Binds the worker before it allocates anything, so its queues and the
+    // rest of its stack are first touched on its own node. It then waits for
+    // the other workers, since it may steal from any of them. A worker that
+    // restarts a retired slot finds its queues already built and keeps them.
+    void initWorker(size_t index) {
+        const auto& worker = _workers[index];
+        bindToCpus(worker.cpus);
+        if (!_localQueues.empty() && !_localQueues[index]) {
+            _localQueues[index] = std::make_unique<WorkStealingQueue>();
+        }
+        if (index < _nodes.size() && !_nodes[index]) {
+            _nodes[index] = std::make_unique<NodeQueue>();
+            if (0u != _ringCapacity) {
+                _nodes[index]->ring =
+                    std::make_unique<MpmcQueue<TaskWrapper>>(_ringCapacity);
+            }
+        }
+        _localPool = this;
+        _localIndex = index;
+        _localNode = worker.node;
+        _localQueue =
+            _localQueues.empty() ? nullptr : _localQueues[index].get();
+        std::unique_lock<std::mutex> l{_wake.m};
+        if (++_ready == _initialThreads) {
+            _wake.cv.notify_all();
+        }
+        _wake.cv.wait(l, [&] { return _ready >= _initialThreads || _done; });
+    }
+
+    // Only the owning worker writes its counters, so a relaxed load and
+    // store is enough and saves the locked instruction.
+    static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount,
+                      std::memory_order_relaxed);
+    }
+
+    void runTask(TaskWrapper& task, WorkerCounters& counters) {
+        bump(counters.tasks, 1);
+        if (!_recordTimings) {
+            task();
+            return;
+        }
+        const auto begin = nowNs();
+        if (0 != task.enqueuedAt()) {
+            counters.queueWait.record(
+                std::chrono::nanoseconds{begin - task.enqueuedAt()});
+        }
+        task();
+        const auto end = nowNs();
+        counters.execution.record(std::chrono::nanoseconds{end - begin});
+        bump(counters.busyNs, static_cast<uint64_t>(end - begin));
+        const auto spans = counters.traceSize.load(std::memory_order_relaxed);
+        if (spans < counters.traceCapacity) {
+            counters.trace[spans] = TraceSpan{begin, end};
+            counters.traceSize.store(spans + 1, std::memory_order_release);
+        }
+    }
+
+    void workerThread(size_t index) {
+        initWorker(index);
+        auto& counters = _workerCounters[index];
+        while (!_done) {
+            if (surplus(index) && tryRetire(index)) {
+                break;
+            }
+            TaskWrapper task;
+            if (tryPop(task)) {
+                runTask(task, counters);
+                continue;
+            }
+            const auto parked = timestamp();
+            const bool idleTimeout = waitForTask(index);
+            if (0 != parked) {
+                bump(counters.idleNs, static_cast<uint64_t>(nowNs() - parked));
+            }
+            if (idleTimeout) {
+                shrinkIdle(index);
+            }
+        }
+        // Whatever is left in the deque moves to the node's shared queue,
+        // where other workers (or the shutdown cleanup) find it.
+        if (_localQueue) {
+            TaskWrapper task;
+            while (_localQueue->tryPop(task)) {
+                pushToNode(_localNode, std::move(task));
+            }
+        }
+        _localQueue = nullptr;
+        _localPool = nullptr;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> l{_wake.m};
+            _done = true;
+        }
+        _wake.cv.notify_all();
+    }
+
+    struct TaskQueue {
+        RingDeque<TaskWrapper> q;
+        std::mutex m;
+        // Mirrors q.size() so pollers can skip the lock when it is empty.
+        std::atomic<size_t> size{0};
+    };
+
+    // Shared queue of one NUMA node. The ring exists only for
+    // QueueBackend::LockFree.
+    struct NodeQueue {
+        TaskQueue queue;
+        std::unique_ptr<MpmcQueue<TaskWrapper>> ring;
+    };
+
+    struct WakeSignal {
+        std::mutex m;
+        std::condition_variable cv;
+        // Signalled when a worker parks while shutdown() is draining.
+        std::condition_variable drained;
+    };
+
+    struct TraceSpan {
+        int64_t begin;
+        int64_t end;
+    };
+
+    // Written only by the worker in the slot (one at a time), read by
+    // stats() and writeChromeTrace(). Aligned so neighbouring workers do
+    // not share a cache line.
+    struct alignas(64) WorkerCounters {
+        std::atomic<uint64_t> tasks{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> busyNs{0};
+        std::atomic<uint64_t> idleNs{0};
+        LatencyHistogram queueWait;
+        LatencyHistogram execution;
+        // Spans are filled in order and published by traceSize.
+        std::unique_ptr<TraceSpan[]> trace;
+        size_t traceCapacity = 0;
+        std::atomic<size_t> traceSize{0};
+    };
+
+    // Which node's queue a worker serves and the CPUs it is bound to; no
+    // CPUs leaves it unbound. `running` is guarded by _resizeMutex.
+    struct WorkerPlacement {
+        size_t node = 0;
+        std::vector<int> cpus;
+        bool running = false;
+    };
+
+    inline static thread_local ThreadPool* _localPool = nullptr;
+    inline static thread_local WorkStealingQueue* _localQueue = nullptr;
+    inline static thread_local size_t _localIndex = 0;
+    inline static thread_local size_t _localNode = 0;
+    inline static thread_local unsigned _pickCount = 0;
 
 private:
     std::atomic_bool _done;
-    mutable TaskQueue _queue;
+    // Signed, see pending().
+    std::atomic<std::ptrdiff_t> _pending{0};
+    std::atomic<size_t> _maxPending{0};
+    std::atomic<size_t> _sleepers{0};
+    std::vector<std::unique_ptr<NodeQueue>> _nodes;
+    size_t _ringCapacity = 0;
+    // CPU number -> node, only filled in when there is more than one node.
+    std::vector<size_t> _cpuNode;
+    PriorityQueues _priority;
+    WakeSignal _wake;
+    // One slot per possible worker, up to Options::maxThreads.
+    std::vector<WorkerPlacement> _workers;
+    size_t _ready = 0;
+    size_t _initialThreads = 0;
+    // Workers that should be running, workers that are, and the number of
+    // slots ever used (the range thieves scan).
+    std::atomic<size_t> _target{0};
+    std::atomic<size_t> _live{0};
+    std::atomic<size_t> _slotsUsed{0};
+    std::mutex _resizeMutex;
+    bool _stopping = false;
+    bool _draining = false;
+    bool _elastic = false;
+    size_t _minThreads = 1;
+    std::chrono::steady_clock::duration _idleTimeout{};
+    size_t _growBacklog = 1;
+    std::unique_ptr<WorkerCounters[]> _workerCounters;
+    bool _recordTimings = false;
+    int64_t _epochNs = 0;
+    std::vector<std::unique_ptr<WorkStealingQueue>> _localQueues;
     std::vector<std::thread> _threads;
     JoinThreads _joiner;
 };
+
+namespace detail {
+
+// Completion state shared by a Future and whatever produces its value.
+// Reference counted by hand so that a task, its result and the link to the
+// next stage live in a single allocation.
+class FutureStateBase {
+public:
+    explicit FutureStateBase(ThreadPool* pool) : _pool{pool} {}
+    virtual ~FutureStateBase() = default;
+
+    FutureStateBase(const FutureStateBase&) = delete;
+    FutureStateBase& operator=(const FutureStateBase&) = delete;
+
+    void addRef() { _refs.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+        if (1u == _refs.fetch_sub(1, std::memory_order_acq_rel)) {
+            delete this;
+        }
+    }
+
+    ThreadPool* pool() const { return _pool; }
+    bool ready() const {
+        return Ready == _stage.load(std::memory_order_acquire);
+    }
+
+    // Blocks until ready. Pool workers keep running other tasks meanwhile,
+    // which keeps a small pool from deadlocking on its own results.
+    void wait() {
+        if (_pool && _pool->isWorkerThread()) {
+            while (!ready()) {
+                if (!_pool->tryRunPendingTask()) {
+                    std::this_thread::yield();
+                }
+            }
+            return;
+        }
+        for (auto stage = _stage.load(std::memory_order_acquire);
+             Ready != stage; stage = _stage.load(std::memory_order_acquire)) {
+            _stage.wait(stage, std::memory_order_acquire);
+        }
+    }
+
+    // Arranges for `next` to be dispatched once this state is ready (right
+    // away if it already is). Takes over one reference to `next`.
+    void setContinuation(FutureStateBase* next) {
+        _continuation = next;
+        auto expected = Pending;
+        if (!_stage.compare_exchange_strong(expected, Chained,
+                                            std::memory_order_acq_rel)) {
+            _continuation = nullptr;
+            dispatch(next);
+        }
+    }
+
+    // Work this state stands for; only task and continuation states have any.
+    virtual void run() {}
+    // Called instead of run() when the work can never happen, e.g. because
+    // its pool shut down with the task still queued.
+    virtual void abandon() {}
+    // Bookkeeping continuations (when_all/when_any) run on the thread that
+    // completes their input instead of going through the queue.
+    virtual bool runsInline() const { return false; }
+
+protected:
+    void complete() {
+        if (Chained == _stage.exchange(Ready, std::memory_order_acq_rel)) {
+            dispatch(std::exchange(_continuation, nullptr));
+        }
+        _stage.notify_all();
+    }
+
+private:
+    // Owns one reference to a state queued on a pool; abandons the state if
+    // the task is destroyed without having run.
+    class Scheduled {
+    public:
+        explicit Scheduled(FutureStateBase* state) : _state{state} {}
+        Scheduled(Scheduled&& other) noexcept
+            : _state{std::exchange(other._state, nullptr)} {}
+        Scheduled& operator=(Scheduled&&) = delete;
+        ~Scheduled() {
+            if (_state) {
+                _state->abandon();
+                _state->release();
+            }
+        }
+
+        void operator()() {
+            auto state = std::exchange(_state, nullptr);
+            state->run();
+            state->release();
+        }
+
+    private:
+        FutureStateBase* _state;
+    };
+
+    // Never throws into the thread completing the previous stage.
+    static void dispatch(FutureStateBase* next) noexcept {
+        auto pool = next->pool();
+        if (next->runsInline() || !pool) {
+            next->run();
+            next->release();
+        } else if (pool->_done) {
+            next->abandon();
+            next->release();
+        } else {
+            try {
+                pool->push(Scheduled{next});
+            } catch (...) {
+                // The pool stopped after the check above. The Scheduled
+                // that push() refused has already abandoned and released
+                // `next`.
+            }
+        }
+    }
+
+    friend class THREAD_POOL_NAMESPACE_NAME::ThreadPool;
+
+    static constexpr uint8_t Pending = 0;
+    static constexpr uint8_t Chained = 1;
+    static constexpr uint8_t Ready = 2;
+
+    ThreadPool* _pool;
+    std::atomic<uint32_t> _refs{1};
+    std::atomic<uint8_t> _stage{Pending};
+    FutureStateBase* _continuation = nullptr;
+};
+
+template <typename T>
+class FutureState : public FutureStateBase {
+public:
+    using Stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+    using FutureStateBase::FutureStateBase;
+
+    template <typename... V>
+    void setValue(V&&... value) {
+        _value.emplace(std::forward<V>(value)...);
+        complete();
+    }
+
+    void setException(std::exception_ptr error) {
+        _error = std::move(error);
+        complete();
+    }
+
+    // Moves the result out, rethrowing the stored exception if there is one.
+    Stored take() {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+        return std::move(*_value);
+    }
+
+    void abandon() override {
+        setException(std::make_exception_ptr(
+            std::future_error{std::future_errc::broken_promise}));
+    }
+
+protected:
+    // Stores fn()'s result, or the exception it threw.
+    template <typename F>
+    void fulfil(F& fn) {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                fn();
+                setValue();
+            } else {
+                setValue(fn());
+            }
+        } catch (...) {
+            setException(std::current_exception());
+        }
+    }
+
+private:
+    std::optional<Stored> _value;
+    std::exception_ptr _error;
+};
+
+template <typename T, typename F>
+class TaskState final : public FutureState<T> {
+public:
+    TaskState(ThreadPool* pool, F fn)
+        : FutureState<T>{pool}, _fn{std::move(fn)} {}
+
+    void run() override { this->fulfil(_fn); }
+
+private:
+    F _fn;
+};
+
+// Resumes a coroutine suspended in `co_await future`.
+class ResumeState final : public FutureStateBase {
+public:
+    ResumeState(ThreadPool* pool, std::coroutine_handle<> handle)
+        : FutureStateBase{pool}, _handle{handle} {}
+
+    void run() override { _handle.resume(); }
+    // The awaited state is ready (possibly with broken_promise) even if the
+    // pool is gone, so let the coroutine observe it rather than leak.
+    void abandon() override { _handle.resume(); }
+
+private:
+    std::coroutine_handle<> _handle;
+};
+
+template <typename F>
+class InlineContinuation final : public FutureStateBase {
+public:
+    explicit InlineContinuation(F fn)
+        : FutureStateBase{nullptr}, _fn{std::move(fn)} {}
+
+    void run() override { _fn(); }
+    bool runsInline() const override { return true; }
+
+private:
+    F _fn;
+};
+
+// Owning handle to one reference of a state.
+template <typename S>
+class StateRef {
+public:
+    StateRef() = default;
+    // Adopts a reference the caller already owns.
+    explicit StateRef(S* state) : _state{state} {}
+    StateRef(const StateRef& other) : _state{other._state} {
+        if (_state) {
+            _state->addRef();
+        }
+    }
+    StateRef(StateRef&& other) noexcept
+        : _state{std::exchange(other._state, nullptr)} {}
+    StateRef& operator=(StateRef other) noexcept {
+        std::swap(_state, other._state);
+        return *this;
+    }
+    ~StateRef() {
+        if (_state) {
+            _state->release();
+        }
+    }
+
+    S* get() const { return _state; }
+    S* operator->() const { return _state; }
+    explicit operator bool() const { return nullptr != _state; }
+
+private:
+    S* _state = nullptr;
+};
+
+} // namespace detail
+
+// Result of ThreadPool::async(). Unlike std::future it can be chained:
+// then() queues the next stage on the pool as soon as this one is done.
+template <typename T>
+class Future {
+public:
+    Future() = default;
+
+    bool valid() const { return static_cast<bool>(_state); }
+    bool ready() const { return _state->ready(); }
+
+    // Blocks until the value is available (see FutureStateBase::wait) and
+    // returns it, rethrowing the task's exception if it failed. Leaves the
+    // future invalid.
+    T get() {
+        auto state = std::move(_state);
+        state->wait();
+        if constexpr (std::is_void_v<T>) {
+            state->take();
+        } else {
+            return state->take();
+        }
+    }
+
+    // Queues fn(value) (or fn() for Future<void>) on the pool once this
+    // future is ready and returns a future for its result. If this future
+    // failed, fn is skipped and the exception carries over. Leaves this
+    // future invalid.
+    template <typename FunctionT>
+    auto then(FunctionT fn) {
+        auto source = _state.get();
+        auto step = [prev = std::move(_state), fn = std::move(fn)]() mutable {
+            if constexpr (std::is_void_v<T>) {
+                prev->take();
+                return fn();
+            } else {
+                return fn(prev->take());
+            }
+        };
+        using ResultT = decltype(step());
+        auto next = new detail::TaskState<ResultT, decltype(step)>{
+            source->pool(), std::move(step)};
+        // One reference for the continuation link, one for the result.
+        next->addRef();
+        source->setContinuation(next);
+        return Future<ResultT>{next};
+    }
+
+    // Suspends the awaiting coroutine until the value is ready; it resumes on
+    // the future's pool. Leaves the future invalid.
+    auto operator co_await() {
+        struct Awaiter {
+            detail::StateRef<detail::FutureState<T>> state;
+
+            bool await_ready() const { return state->ready(); }
+            void await_suspend(std::coroutine_handle<> handle) {
+                state->setContinuation(
+                    new detail::ResumeState{state->pool(), handle});
+            }
+            T await_resume() {
+                if constexpr (std::is_void_v<T>) {
+                    state->take();
+                } else {
+                    return state->take();
+                }
+            }
+        };
+        return Awaiter{std::move(_state)};
+    }
+
+private:
+    template <typename>
+    friend class Future;
+    friend class ThreadPool;
+    template <typename U>
+    friend auto when_all(std::vector<Future<U>> futures);
+    template <typename U>
+    friend auto when_any(std::vector<Future<U>> futures);
+
+    // Adopts one reference.
+    explicit Future(detail::FutureState<T>* state) : _state{state} {}
+
+    detail::StateRef<detail::FutureState<T>> _state;
+};
+
+// Becomes ready once every input is ready. Yields the values in input order
+// (nothing for Future<void>); if any input failed, the first failure in
+// input order is rethrown instead.
+template <typename T>
+auto when_all(std::vector<Future<T>> futures) {
+    using Input = detail::FutureState<T>;
+    using ResultT = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+    ThreadPool* pool =
+        futures.empty() ? nullptr : futures.front()._state->pool();
+    auto result = new detail::FutureState<ResultT>{pool};
+    Future<ResultT> future{result};
+    if (futures.empty()) {
+        if constexpr (std::is_void_v<T>) {
+            result->setValue();
+        } else {
+            result->setValue(ResultT{});
+        }
+        return future;
+    }
+
+    struct Join {
+        std::vector<detail::StateRef<Input>> inputs;
+        std::atomic<size_t> remaining;
+        detail::StateRef<detail::FutureState<ResultT>> result;
+
+        void finish() {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    for (auto& input : inputs) {
+                        input->take();
+                    }
+                    result->setValue();
+                } else {
+                    ResultT values;
+                    values.reserve(inputs.size());
+                    for (auto& input : inputs) {
+                        values.push_back(input->take());
+                    }
+                    result->setValue(std::move(values));
+                }
+            } catch (...) {
+                result->setException(std::current_exception());
+            }
+        }
+    };
+    auto join = std::make_shared<Join>();
+    join->remaining = futures.size();
+    result->addRef();
+    join->result = detail::StateRef<detail::FutureState<ResultT>>{result};
+    for (auto& f : futures) {
+        join->inputs.push_back(std::move(f._state));
+    }
+    for (auto& input : join->inputs) {
+        auto onReady = [join] {
+            if (1u == join->remaining.fetch_sub(1, std::memory_order_acq_rel)) {
+                join->finish();
+            }
+        };
+        using Continuation = detail::InlineContinuation<decltype(onReady)>;
+        input->setContinuation(new Continuation{std::move(onReady)});
+    }
+    return future;
+}
+
+// Becomes ready as soon as the first input is ready and yields its index
+// together with its value (just the index for Future<void>), or rethrows its
+// exception. Throws std::invalid_argument for an empty input.
+template <typename T>
+auto when_any(std::vector<Future<T>> futures) {
+    using Input = detail::FutureState<T>;
+    using ResultT = std::conditional_t<std::is_void_v<T>, size_t,
+                                       std::pair<size_t, T>>;
+    if (futures.empty()) {
+        throw std::invalid_argument{"when_any needs at least one future"};
+    }
+    auto result =
+        new detail::FutureState<ResultT>{futures.front()._state->pool()};
+    Future<ResultT> future{result};
+
+    struct Race {
+        std::atomic_bool decided{false};
+        detail::StateRef<detail::FutureState<ResultT>> result;
+    };
+    auto race = std::make_shared<Race>();
+    result->addRef();
+    race->result = detail::StateRef<detail::FutureState<ResultT>>{result};
+    for (size_t i = 0; i < futures.size(); ++i) {
+        auto input = std::move(futures[i]._state);
+        Input* source = input.get();
+        auto onReady = [race, input = std::move(input), i]() mutable {
+            if (race->decided.exchange(true, std::memory_order_acq_rel)) {
+                return;
+            }
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    input->take();
+                    race->result->setValue(i);
+                } else {
+                    race->result->setValue(ResultT{i, input->take()});
+                }
+            } catch (...) {
+                race->result->setException(std::current_exception());
+            }
+        };
+        using Continuation = detail::InlineContinuation<decltype(onReady)>;
+        source->setContinuation(new Continuation{std::move(onReady)});
+    }
+    return future;
+}
+
+namespace detail {
+
+// Per-thread cache of coroutine frames in 64-byte size classes up to 1 KiB.
+// A frame freed on another thread than it was allocated on simply joins that
+// thread's cache, so after warm-up resuming and finishing coroutines on pool
+// workers does not touch the global heap.
+class FrameAllocator {
+public:
+    static void* allocate(size_t size) {
+        const auto sizeClass = classOf(size);
+        if (sizeClass >= kClasses) {
+            return ::operator new(size);
+        }
+        auto& cache = local();
+        if (auto block = cache.free[sizeClass]) {
+            cache.free[sizeClass] = block->next;
+            --cache.count[sizeClass];
+            return block;
+        }
+        return ::operator new((sizeClass + 1) * kGranularity);
+    }
+
+    static void deallocate(void* p, size_t size) {
+        const auto sizeClass = classOf(size);
+        if (sizeClass >= kClasses) {
+            ::operator delete(p);
+            return;
+        }
+        auto& cache = local();
+        if (cache.count[sizeClass] >= kMaxCached) {
+            ::operator delete(p);
+            return;
+        }
+        cache.free[sizeClass] = ::new (p) Block{cache.free[sizeClass]};
+        ++cache.count[sizeClass];
+    }
+
+private:
+    static constexpr size_t kGranularity = 64;
+    static constexpr size_t kClasses = 16;
+    static constexpr size_t kMaxCached = 1024;
+
+    struct Block {
+        Block* next;
+    };
+
+    struct Cache {
+        std::array<Block*, kClasses> free{};
+        std::array<size_t, kClasses> count{};
+
+        ~Cache() {
+            for (auto block : free) {
+                while (block) {
+                    ::operator delete(std::exchange(block, block->next));
+                }
+            }
+        }
+    };
+
+    static size_t classOf(size_t size) {
+        return (std::max<size_t>(size, 1u) - 1) / kGranularity;
+    }
+
+    static Cache& local() {
+        thread_local Cache cache;
+        return cache;
+    }
+};
+
+struct SyncWaitSignal {
+    std::mutex m;
+    std::condition_variable cv;
+    bool done = false;
+};
+
+class TaskPromiseBase {
+public:
+    static void* operator new(size_t size) {
+        return FrameAllocator::allocate(size);
+    }
+    static void operator delete(void* p, size_t size) {
+        FrameAllocator::deallocate(p, size);
+    }
+
+    // Hands control straight to whoever awaited the task.
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<P> handle) noexcept {
+            TaskPromiseBase& promise = handle.promise();
+            const auto continuation = promise._continuation;
+            if (auto signal = promise._signal) {
+                // sync_wait() may destroy the frame as soon as the lock is
+                // released, so nothing in the frame is read after this.
+                std::lock_guard<std::mutex> l{signal->m};
+                signal->done = true;
+                signal->cv.notify_one();
+            }
+            if (continuation) {
+                return continuation;
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { _error = std::current_exception(); }
+
+    std::coroutine_handle<> _continuation;
+    SyncWaitSignal* _signal = nullptr;
+
+protected:
+    void rethrowIfFailed() {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+private:
+    std::exception_ptr _error;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    template <typename V>
+    void return_value(V&& value) {
+        _value.emplace(std::forward<V>(value));
+    }
+
+    T result() {
+        rethrowIfFailed();
+        return std::move(*_value);
+    }
+
+private:
+    std::optional<T> _value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    void return_void() {}
+    void result() { rethrowIfFailed(); }
+};
+
+// Eagerly started, self-destroying coroutine behind ThreadPool::spawn().
+struct DetachedTask {
+    struct promise_type : TaskPromiseBase {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+} // namespace detail
+
+// Lazily started coroutine returning T. It runs when awaited, resumes its
+// awaiter when it finishes and keeps its frame in the per-thread frame
+// cache. Move onto a pool with `co_await pool.schedule()` and block on the
+// result at the edge of the program with sync_wait().
+template <typename T = void>
+class Task {
+public:
+    struct promise_type : detail::TaskPromise<T> {
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+    };
+
+    Task(Task&& other) noexcept
+        : _handle{std::exchange(other._handle, nullptr)} {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (_handle) {
+                _handle.destroy();
+            }
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept { return handle.done(); }
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise()._continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaiter{_handle};
+    }
+
+private:
+    template <typename U>
+    friend U sync_wait(Task<U> task);
+
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : _handle{handle} {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+// Starts the task on the calling thread and blocks until it has finished,
+// wherever it ended up running. Must not be called from a pool worker that
+// the task needs in order to make progress.
+template <typename T>
+T sync_wait(Task<T> task) {
+    detail::SyncWaitSignal signal;
+    task._handle.promise()._signal = &signal;
+    task._handle.resume();
+    std::unique_lock<std::mutex> l{signal.m};
+    signal.cv.wait(l, [&] { return signal.done; });
+    return task._handle.promise().result();
+}
+
+template <typename T>
+void ThreadPool::spawn(Task<T> task) {
+    [](ThreadPool& pool, Task<T> task) -> detail::DetachedTask {
+        co_await pool.schedule();
+        co_await std::move(task);
+    }(*this, std::move(task));
+}
+
+template <typename FunctionT, typename... Args>
+auto ThreadPool::async(FunctionT f, Args... args)
+    -> Future<std::invoke_result_t<FunctionT&, Args&...>> {
+    using ResultT = std::invoke_result_t<FunctionT&, Args&...>;
+    auto fn = [f = std::move(f), args...]() mutable {
+        return std::invoke(f, args...);
+    };
+    auto state =
+        new detail::TaskState<ResultT, decltype(fn)>{this, std::move(fn)};
+    state->addRef();
+    push(detail::FutureStateBase::Scheduled{state});
+    return Future<ResultT>{state};
+}
+
 } // namespace THREAD_POOL_NAMESPACE_NAME
@@ -0,0 +1,753 @@
+// Throughput and latency comparison of the ThreadPool configurations.
+//
+// Build: g++ -std=c++20 -O2 -pthread ThreadPoolBenchmark.cpp
+// Run:   ./a.out [scheduling|backend|alloc|parallel|priority|futures|
+//                 coroutines|numa|elastic|stats [trace.json]]
+//        (no argument runs everything)
+//
+// The 'alloc' section also acts as a check: it exits non-zero if a detached
+// task that fits the inline buffer causes a heap allocation. 'elastic'
+// exits non-zero if a draining shutdown loses a task.
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <new>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using thread_pool::Future;
+using thread_pool::LatencyHistogram;
+using thread_pool::Task;
+using thread_pool::ThreadPool;
+
+namespace {
+std::atomic<size_t> gAllocations{0};
+} // namespace
+
+// GCC cannot see that the replaced operator new below returns malloc memory.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr size_t kFlatTasks = 200000;
+constexpr unsigned kFanOutDepth = 14;
+constexpr size_t kSubmitsPerProducer = 50000;
+
+void waitFor(const std::atomic<size_t>& remaining) {
+    while (0u != remaining.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+// All tasks are submitted from the main thread.
+double flat(ThreadPool& pool) {
+    std::atomic<size_t> remaining{kFlatTasks};
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kFlatTasks; ++i) {
+        pool.submit([&remaining] {
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    waitFor(remaining);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start).count();
+}
+
+// Every task submits two children until kFanOutDepth, so almost all
+// submissions come from worker threads.
+void fanOut(ThreadPool& pool, std::atomic<size_t>& remaining, unsigned depth) {
+    if (depth < kFanOutDepth) {
+        remaining.fetch_add(2, std::memory_order_relaxed);
+        pool.submit([&pool, &remaining, depth] {
+            fanOut(pool, remaining, depth + 1);
+        });
+        pool.submit([&pool, &remaining, depth] {
+            fanOut(pool, remaining, depth + 1);
+        });
+    }
+    remaining.fetch_sub(1, std::memory_order_release);
+}
+
+double nested(ThreadPool& pool) {
+    std::atomic<size_t> remaining{1};
+    const auto start = std::chrono::steady_clock::now();
+    pool.submit([&pool, &remaining] { fanOut(pool, remaining, 0); });
+    waitFor(remaining);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start).count();
+}
+
+const char* name(ThreadPool::Scheduling scheduling) {
+    switch (scheduling) {
+        case ThreadPool::Scheduling::GlobalQueue:  return "global";
+        case ThreadPool::Scheduling::WorkStealing: return "stealing";
+        default:                                   return "unknown";
+    }
+}
+
+const char* name(ThreadPool::QueueBackend backend) {
+    switch (backend) {
+        case ThreadPool::QueueBackend::Mutex:    return "mutex";
+        case ThreadPool::QueueBackend::LockFree: return "lockfree";
+        default:                                 return "unknown";
+    }
+}
+
+void benchScheduling() {
+    const size_t nestedTasks = (size_t{2} << kFanOutDepth) - 1;
+    printf("%-8s %-9s %14s %14s\n", "threads", "mode", "flat Mtask/s",
+           "nested Mtask/s");
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        for (auto scheduling : {ThreadPool::Scheduling::GlobalQueue,
+                                ThreadPool::Scheduling::WorkStealing}) {
+            ThreadPool pool{threads, scheduling};
+            const auto flatSeconds = flat(pool);
+            const auto nestedSeconds = nested(pool);
+            printf("%-8zu %-9s %14.2f %14.2f\n", threads, name(scheduling),
+                   kFlatTasks / flatSeconds / 1e6,
+                   nestedTasks / nestedSeconds / 1e6);
+        }
+    }
+}
+
+// Several producers hammer submit() with empty tasks; reports overall
+// throughput and the 99th percentile of the time spent inside submit().
+void benchBackend() {
+    const size_t workers = std::max(2u, std::thread::hardware_concurrency());
+    printf("%-10s %-9s %12s %14s\n", "producers", "backend", "Mtask/s",
+           "p99 submit ns");
+    for (size_t producers = 1; producers <= 16; producers *= 2) {
+        for (auto backend : {ThreadPool::QueueBackend::Mutex,
+                             ThreadPool::QueueBackend::LockFree}) {
+            ThreadPool::Options options;
+            options.threadCount = workers;
+            options.queueBackend = backend;
+            ThreadPool pool{options};
+
+            const size_t total = producers * kSubmitsPerProducer;
+            std::atomic<size_t> remaining{total};
+            std::vector<std::vector<double>> latencies(producers);
+            std::vector<std::thread> threads;
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t p = 0; p < producers; ++p) {
+                threads.emplace_back([&, p] {
+                    auto& samples = latencies[p];
+                    samples.reserve(kSubmitsPerProducer);
+                    for (size_t i = 0; i < kSubmitsPerProducer; ++i) {
+                        const auto before = std::chrono::steady_clock::now();
+                        pool.submit([&remaining] {
+                            remaining.fetch_sub(1, std::memory_order_release);
+                        });
+                        const auto after = std::chrono::steady_clock::now();
+                        samples.push_back(
+                            std::chrono::duration<double, std::nano>(after -
+                                                                     before)
+                                .count());
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            waitFor(remaining);
+            const auto seconds = std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+
+            std::vector<double> all;
+            all.reserve(total);
+            for (const auto& samples : latencies) {
+                all.insert(all.end(), samples.begin(), samples.end());
+            }
+            const auto p99 = all.begin() + static_cast<std::ptrdiff_t>(
+                                               all.size() * 99 / 100);
+            std::nth_element(all.begin(), p99, all.end());
+            printf("%-10zu %-9s %12.2f %14.0f\n", producers, name(backend),
+                   total / seconds / 1e6, *p99);
+        }
+    }
+}
+
+// Counts heap allocations per task once the pool has warmed up its queues.
+// Tasks go in bounded batches so the backlog, and with it the queue storage,
+// is the same in the warm-up and the measured round.
+template <typename SubmitT>
+double allocationsPerTask(ThreadPool& pool, SubmitT submitOne) {
+    constexpr size_t kBatch = 1000;
+    constexpr size_t kBatches = 100;
+    for (unsigned round = 0; round < 2; ++round) {
+        const auto before = gAllocations.load();
+        for (size_t batch = 0; batch < kBatches; ++batch) {
+            std::atomic<size_t> remaining{kBatch};
+            for (size_t i = 0; i < kBatch; ++i) {
+                submitOne(pool, remaining);
+            }
+            waitFor(remaining);
+        }
+        if (1u == round) {
+            return static_cast<double>(gAllocations.load() - before) /
+                   (kBatch * kBatches);
+        }
+    }
+    return 0.0;
+}
+
+bool benchAllocations() {
+    bool ok = true;
+    printf("%-9s %-9s %10s %10s %10s\n", "mode", "backend", "detached",
+           "large", "future");
+    for (auto scheduling : {ThreadPool::Scheduling::GlobalQueue,
+                            ThreadPool::Scheduling::WorkStealing}) {
+        for (auto backend : {ThreadPool::QueueBackend::Mutex,
+                             ThreadPool::QueueBackend::LockFree}) {
+            ThreadPool::Options options;
+            options.threadCount = 2;
+            options.scheduling = scheduling;
+            options.queueBackend = backend;
+            ThreadPool pool{options};
+
+            const auto small = allocationsPerTask(
+                pool, [](ThreadPool& p, std::atomic<size_t>& remaining) {
+                    p.submit_detached([&remaining] {
+                        remaining.fetch_sub(1, std::memory_order_release);
+                    });
+                });
+            const auto large = allocationsPerTask(
+                pool, [](ThreadPool& p, std::atomic<size_t>& remaining) {
+                    std::array<char, 2 * ThreadPool::kTaskInlineSize> payload{};
+                    p.submit_detached([&remaining, payload] {
+                        remaining.fetch_sub(1 + payload[0],
+                                            std::memory_order_release);
+                    });
+                });
+            const auto future = allocationsPerTask(
+                pool, [](ThreadPool& p, std::atomic<size_t>& remaining) {
+                    p.submit([&remaining] {
+                        remaining.fetch_sub(1, std::memory_order_release);
+                    });
+                });
+            printf("%-9s %-9s %10.5f %10.5f %10.5f\n", name(scheduling),
+                   name(backend), small, large, future);
+            ok = ok && 0.0 == small;
+        }
+    }
+    printf("small detached tasks allocation-free: %s\n", ok ? "yes" : "NO");
+    return ok;
+}
+
+template <typename BodyT>
+double timeRounds(size_t rounds, BodyT body) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        body();
+    }
+    return std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - start)
+               .count() /
+           rounds;
+}
+
+// A 10k element loop fanned out by hand with one future per element, with
+// one submit_detached per element, with submit_bulk, and with parallel_for.
+bool benchParallel() {
+    constexpr size_t kElements = 10000;
+    constexpr size_t kRounds = 50;
+    std::vector<double> data(kElements);
+    std::iota(data.begin(), data.end(), 0.0);
+    const auto work = [&data](size_t i) { data[i] = data[i] * 0.5 + 1.0; };
+
+    printf("%-8s %12s %12s %12s %12s %12s\n", "threads", "futures us",
+           "detached us", "bulk us", "for us", "reduce us");
+    bool ok = true;
+    for (size_t threads = 1; threads <= 16; threads *= 2) {
+        ThreadPool pool{threads, ThreadPool::Scheduling::WorkStealing};
+
+        const auto futures = timeRounds(kRounds, [&] {
+            std::vector<std::future<void>> pending;
+            pending.reserve(kElements);
+            for (size_t i = 0; i < kElements; ++i) {
+                pending.push_back(pool.submit(work, i));
+            }
+            for (auto& f : pending) {
+                f.get();
+            }
+        });
+        const auto detached = timeRounds(kRounds, [&] {
+            std::atomic<size_t> remaining{kElements};
+            for (size_t i = 0; i < kElements; ++i) {
+                pool.submit_detached([&, i] {
+                    work(i);
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
+            }
+            waitFor(remaining);
+        });
+        const auto bulk = timeRounds(kRounds, [&] {
+            std::atomic<size_t> remaining{kElements};
+            struct Element {
+                decltype(work)* body;
+                std::atomic<size_t>* remaining;
+                size_t i;
+                void operator()() const {
+                    (*body)(i);
+                    remaining->fetch_sub(1, std::memory_order_release);
+                }
+            };
+            std::vector<Element> tasks;
+            tasks.reserve(kElements);
+            for (size_t i = 0; i < kElements; ++i) {
+                tasks.push_back({&work, &remaining, i});
+            }
+            pool.submit_bulk(tasks.begin(), tasks.end());
+            waitFor(remaining);
+        });
+        const auto loop = timeRounds(kRounds, [&] {
+            pool.parallel_for(size_t{0}, kElements, 0, work);
+        });
+        double sum = 0.0;
+        const auto reduce = timeRounds(kRounds, [&] {
+            sum = pool.parallel_reduce(
+                size_t{0}, kElements, 0, 0.0,
+                [](size_t i) { return static_cast<double>(i); },
+                [](double a, double b) { return a + b; });
+        });
+        ok = ok && sum == (kElements - 1) * kElements / 2.0;
+        printf("%-8zu %12.1f %12.1f %12.1f %12.1f %12.1f\n", threads,
+               futures, detached, bulk, loop, reduce);
+    }
+    printf("parallel_reduce result correct: %s\n", ok ? "yes" : "NO");
+    return ok;
+}
+
+void spinFor(std::chrono::microseconds duration) {
+    const auto until = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < until) {
+    }
+}
+
+// Saturates the pool with batch work and measures how long latency-critical
+// tasks queue behind it: once through plain FIFO submit(), once with the
+// batch work in the lowest band and the critical tasks in band 0.
+void benchPriority() {
+    using Clock = std::chrono::steady_clock;
+    constexpr size_t kBatchTasks = 4000;
+    constexpr size_t kCriticalTasks = 200;
+    constexpr auto kBatchWork = std::chrono::microseconds{200};
+    constexpr auto kCriticalPeriod = std::chrono::microseconds{500};
+
+    ThreadPool::Options options;
+    options.threadCount = 4;
+    options.priorityBands = 3;
+
+    LatencyHistogram fifoWait;
+    {
+        ThreadPool pool{options};
+        std::atomic<size_t> remaining{kBatchTasks + kCriticalTasks};
+        for (size_t i = 0; i < kBatchTasks; ++i) {
+            pool.submit_detached([&remaining, kBatchWork] {
+                spinFor(kBatchWork);
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+        }
+        for (size_t i = 0; i < kCriticalTasks; ++i) {
+            pool.submit_detached([&remaining, &fifoWait,
+                                  enqueued = Clock::now()] {
+                fifoWait.record(Clock::now() - enqueued);
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+            std::this_thread::sleep_for(kCriticalPeriod);
+        }
+        waitFor(remaining);
+    }
+
+    std::vector<ThreadPool::BandStats> stats;
+    {
+        ThreadPool pool{options};
+        std::atomic<size_t> remaining{kBatchTasks + kCriticalTasks};
+        for (size_t i = 0; i < kBatchTasks; ++i) {
+            pool.submit_with_priority(2, [&remaining, kBatchWork] {
+                spinFor(kBatchWork);
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+        }
+        for (size_t i = 0; i < kCriticalTasks; ++i) {
+            pool.submit_with_priority(0, [&remaining] {
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+            std::this_thread::sleep_for(kCriticalPeriod);
+        }
+        waitFor(remaining);
+        stats = pool.priorityStats();
+    }
+
+    const auto us = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::micro>(ns).count();
+    };
+    const auto fifo = fifoWait.snapshot();
+    printf("%-14s %8s %12s %12s\n", "queue", "tasks", "p50 wait us",
+           "p99 wait us");
+    printf("%-14s %8llu %12.0f %12.0f\n", "fifo critical",
+           static_cast<unsigned long long>(fifo.total()),
+           us(fifo.percentile(50)), us(fifo.percentile(99)));
+    for (size_t band = 0; band < stats.size(); ++band) {
+        char label[32];
+        if (band + 1 == stats.size()) {
+            snprintf(label, sizeof(label), "deadline");
+        } else {
+            snprintf(label, sizeof(label), "band %zu", band);
+        }
+        const auto& wait = stats[band].waitTime;
+        printf("%-14s %8llu %12.0f %12.0f\n", label,
+               static_cast<unsigned long long>(wait.total()),
+               us(wait.percentile(50)), us(wait.percentile(99)));
+    }
+}
+
+// Three-stage pipelines: with std::future every later stage blocks a worker
+// in get() on its predecessor; with Future::then the next stage is only
+// queued once its input exists. Reports time and allocations per pipeline.
+void benchFutures() {
+    constexpr size_t kPipelines = 20000;
+    const auto stage1 = [](size_t i) { return i + 1; };
+    const auto stage2 = [](size_t v) { return v * 3; };
+    const auto stage3 = [](size_t v) { return v % 7; };
+
+    printf("%-8s %-9s %12s %14s\n", "threads", "futures", "us/pipeline",
+           "allocs/pipe");
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        ThreadPool pool{threads};
+        size_t expected = 0;
+        for (size_t i = 0; i < kPipelines; ++i) {
+            expected += stage3(stage2(stage1(i)));
+        }
+
+        auto allocations = gAllocations.load();
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::future<size_t>> blocking;
+        blocking.reserve(kPipelines);
+        for (size_t i = 0; i < kPipelines; ++i) {
+            auto first = pool.submit(stage1, i);
+            auto second = pool.submit(
+                [stage2, in = std::move(first)]() mutable {
+                    return stage2(in.get());
+                });
+            blocking.push_back(pool.submit(
+                [stage3, in = std::move(second)]() mutable {
+                    return stage3(in.get());
+                }));
+        }
+        size_t sum = 0;
+        for (auto& f : blocking) {
+            sum += f.get();
+        }
+        const auto stdSeconds = std::chrono::duration<double, std::micro>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+        const auto stdAllocations = gAllocations.load() - allocations;
+        blocking.clear();
+
+        allocations = gAllocations.load();
+        start = std::chrono::steady_clock::now();
+        std::vector<Future<size_t>> chained;
+        chained.reserve(kPipelines);
+        for (size_t i = 0; i < kPipelines; ++i) {
+            chained.push_back(
+                pool.async(stage1, i).then(stage2).then(stage3));
+        }
+        size_t chainedSum = 0;
+        for (auto& f : chained) {
+            chainedSum += f.get();
+        }
+        const auto chainedSeconds =
+            std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+        const auto chainedAllocations = gAllocations.load() - allocations;
+
+        printf("%-8zu %-9s %12.3f %14.2f%s\n", threads, "std",
+               stdSeconds / kPipelines,
+               static_cast<double>(stdAllocations) / kPipelines,
+               sum == expected ? "" : "  WRONG RESULT");
+        printf("%-8zu %-9s %12.3f %14.2f%s\n", threads, "then",
+               chainedSeconds / kPipelines,
+               static_cast<double>(chainedAllocations) / kPipelines,
+               chainedSum == expected ? "" : "  WRONG RESULT");
+    }
+}
+
+Task<size_t> hop(ThreadPool& pool, size_t i) {
+    co_await pool.schedule();
+    co_return i;
+}
+
+// One in-flight request: hops between workers `hops` times, each hop a child
+// coroutine whose frame comes from the worker's frame cache.
+Task<void> request(ThreadPool& pool, std::atomic<size_t>& remaining,
+                   size_t hops) {
+    size_t sum = 0;
+    for (size_t i = 0; i < hops; ++i) {
+        sum += co_await hop(pool, i);
+    }
+    if (sum != hops * (hops - 1) / 2) {
+        std::abort();
+    }
+    remaining.fetch_sub(1, std::memory_order_release);
+}
+
+void benchCoroutines() {
+    constexpr size_t kRequests = 10000;
+    constexpr size_t kHops = 20;
+    printf("%-8s %12s %14s %16s\n", "threads", "in flight", "ns/resume",
+           "allocs/frame");
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        ThreadPool pool{threads};
+        double nsPerResume = 0.0;
+        double allocsPerFrame = 0.0;
+        for (unsigned round = 0; round < 2; ++round) {
+            std::atomic<size_t> remaining{kRequests};
+            const auto allocations = gAllocations.load();
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < kRequests; ++i) {
+                pool.spawn(request(pool, remaining, kHops));
+            }
+            waitFor(remaining);
+            const auto elapsed = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start);
+            // Every request is spawned once and resumed once per hop.
+            nsPerResume = elapsed.count() / (kRequests * (kHops + 1));
+            allocsPerFrame =
+                static_cast<double>(gAllocations.load() - allocations) /
+                (kRequests * (kHops + 2));
+        }
+        printf("%-8zu %12zu %14.1f %16.3f\n", threads, kRequests, nsPerResume,
+               allocsPerFrame);
+    }
+}
+
+// Every node owns a buffer that one of its own workers first-touched. Scan
+// tasks are then sent to the owning node, to the next node over, or (for
+// the unplaced pool) wherever the scheduler likes. On a single-node machine
+// all three should match.
+constexpr size_t kNumaBufferBytes = 64u << 20;
+constexpr size_t kNumaSlice = (1u << 20) / sizeof(uint64_t);
+
+void benchNuma() {
+    constexpr size_t kPasses = 4;
+    const auto threads = std::max(1u, std::thread::hardware_concurrency());
+
+    ThreadPool::Options options;
+    options.threadCount = threads;
+    options.scheduling = ThreadPool::Scheduling::WorkStealing;
+    ThreadPool plain{options};
+    options.pinThreads = true;
+    options.numaQueues = true;
+    ThreadPool placed{options};
+    const auto nodes = placed.nodeCount();
+    printf("%u threads, %zu NUMA node(s)\n", threads, nodes);
+
+    std::vector<std::vector<uint64_t>> buffers(nodes);
+    for (size_t node = 0; node < nodes; ++node) {
+        placed.submit_to_node(node, [&buffers, node] {
+            buffers[node].assign(kNumaBufferBytes / sizeof(uint64_t), node + 1);
+        }).get();
+    }
+
+    const auto scan = [&](ThreadPool& pool, bool hinted, size_t shift) {
+        std::vector<std::future<uint64_t>> sums;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t pass = 0; pass < kPasses; ++pass) {
+            for (size_t node = 0; node < nodes; ++node) {
+                const auto& buffer = buffers[node];
+                for (auto at = buffer.begin(); at != buffer.end();
+                     at += kNumaSlice) {
+                    auto task = [at] {
+                        return std::accumulate(at, at + kNumaSlice,
+                                               uint64_t{0});
+                    };
+                    sums.push_back(hinted ? pool.submit_to_node(
+                                                (node + shift) % nodes, task)
+                                          : pool.submit(task));
+                }
+            }
+        }
+        for (auto& sum : sums) {
+            sum.get();
+        }
+        const auto seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        const auto bytes = kPasses * nodes * kNumaBufferBytes;
+        return static_cast<double>(bytes) / seconds / 1e9;
+    };
+
+    printf("%-24s %10s\n", "placement", "GB/s");
+    printf("%-24s %10.2f\n", "unplaced", scan(plain, false, 0));
+    printf("%-24s %10.2f\n", "pinned, local node", scan(placed, true, 0));
+    printf("%-24s %10.2f\n", "pinned, next node", scan(placed, true, 1));
+}
+
+// A burst of spinning tasks followed by an idle spell, on a fixed pool
+// sized for the peak and on an elastic one that starts with a single
+// worker. Then checks that shutdown(Drain) runs tasks queued behind it.
+bool benchElastic() {
+    constexpr size_t kBurst = 2000;
+    const size_t peak = std::max(4u, std::thread::hardware_concurrency());
+    printf("%-10s %10s %12s %12s\n", "pool", "burst ms", "peak workers",
+           "after idle");
+    for (const bool elastic : {false, true}) {
+        ThreadPool::Options options;
+        options.threadCount = elastic ? 1u : peak;
+        options.maxThreads = peak;
+        options.elastic = elastic;
+        options.idleTimeout = std::chrono::milliseconds{50};
+        ThreadPool pool{options};
+        std::atomic<size_t> remaining{kBurst};
+        size_t busiest = pool.capacity();
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < kBurst; ++i) {
+            pool.submit_detached([&remaining] {
+                spinFor(std::chrono::microseconds{100});
+                remaining.fetch_sub(1, std::memory_order_release);
+            });
+            busiest = std::max(busiest, pool.capacity());
+        }
+        waitFor(remaining);
+        const auto ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        std::this_thread::sleep_for(std::chrono::milliseconds{50} * peak * 2);
+        printf("%-10s %10.1f %12zu %12zu\n", elastic ? "elastic" : "fixed",
+               ms, busiest, pool.capacity());
+    }
+
+    std::atomic<size_t> ran{0};
+    {
+        ThreadPool pool{2};
+        for (size_t i = 0; i < kBurst; ++i) {
+            pool.submit_detached([&pool, &ran] {
+                pool.submit_detached([&ran] { ran.fetch_add(1); });
+                ran.fetch_add(1);
+            });
+        }
+        pool.shutdown(ThreadPool::ShutdownMode::Drain);
+    }
+    const bool drained = 2 * kBurst == ran.load();
+    printf("shutdown(Drain) ran every queued task: %s\n",
+           drained ? "yes" : "no");
+    return drained;
+}
+
+// Cost of the instrumentation on the flat submit benchmark, then the
+// per-worker counters of a mixed workload. With a path, also writes the
+// workload's task spans as a Chrome trace.
+void benchStats(const char* tracePath) {
+    printf("%-12s %14s\n", "counters", "flat Mtask/s");
+    for (unsigned mode = 0; mode < 3; ++mode) {
+        ThreadPool::Options options;
+        options.threadCount = 4;
+        options.recordTimings = 1u == mode;
+        options.traceCapacity = 2u == mode ? kFlatTasks : 0u;
+        ThreadPool pool{options};
+        const char* names[] = {"counts", "timings", "trace"};
+        printf("%-12s %14.2f\n", names[mode], kFlatTasks / flat(pool) / 1e6);
+    }
+
+    ThreadPool::Options options;
+    options.threadCount = 4;
+    options.scheduling = ThreadPool::Scheduling::WorkStealing;
+    options.traceCapacity = 4096;
+    ThreadPool pool{options};
+    // Counts the fanOut() call below, which subtracts itself when done.
+    std::atomic<size_t> remaining{1};
+    fanOut(pool, remaining, kFanOutDepth - 8);
+    for (size_t i = 0; i < 200; ++i) {
+        remaining.fetch_add(1);
+        pool.submit_detached([&remaining, i] {
+            spinFor(std::chrono::microseconds{i % 4 == 0 ? 200 : 20});
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    waitFor(remaining);
+
+    const auto stats = pool.stats();
+    printf("\n%-8s %8s %8s %10s %10s %10s %10s\n", "worker", "tasks",
+           "steals", "busy ms", "idle ms", "p99 wait", "p99 exec");
+    const auto row = [](const char* name, const ThreadPool::WorkerStats& w) {
+        const auto us = [](std::chrono::nanoseconds ns) {
+            return static_cast<long long>(ns.count() / 1000);
+        };
+        printf("%-8s %8llu %8llu %10.2f %10.2f %8lldus %8lldus\n", name,
+               static_cast<unsigned long long>(w.tasks),
+               static_cast<unsigned long long>(w.steals), w.busy.count() / 1e6,
+               w.idle.count() / 1e6, us(w.queueWait.percentile(99)),
+               us(w.execution.percentile(99)));
+    };
+    for (size_t i = 0; i < stats.workers.size(); ++i) {
+        const auto name = std::to_string(i);
+        row(name.c_str(), stats.workers[i]);
+    }
+    row("total", stats.total);
+    printf("max queue depth: %zu\n", stats.maxQueueDepth);
+    if (tracePath) {
+        std::ofstream out{tracePath};
+        pool.writeChromeTrace(out);
+        printf("trace written to %s\n", tracePath);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto selected = [&](const char* section) {
+        return argc < 2 || 0 == strcmp(argv[1], section);
+    };
+    if (selected("scheduling")) {
+        benchScheduling();
+    }
+    if (selected("backend")) {
+        benchBackend();
+    }
+    if (selected("alloc") && !benchAllocations()) {
+        return 1;
+    }
+    if (selected("parallel") && !benchParallel()) {
+        return 1;
+    }
+    if (selected("priority")) {
+        benchPriority();
+    }
+    if (selected("futures")) {
+        benchFutures();
+    }
+    if (selected("coroutines")) {
+        benchCoroutines();
+    }
+    if (selected("numa")) {
+        benchNuma();
+    }
+    if (selected("elastic") && !benchElastic()) {
+        return 1;
+    }
+    if (selected("stats")) {
+        benchStats(argc > 2 ? argv[2] : nullptr);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "fsm.h"
+
+#include <cstdint>
+#include <cstdio>
+
+// The BLE machine from fsm_simple.cpp, declared as a transition table.
+
+enum class ble_state : std::uint8_t {
+    idle,
+    advertising,
+    connected
+};
+
+enum class ble_event : std::uint8_t {
+    ble_button_pressed,
+    connection_request,
+    timer_expired
+};
+
+// What the actions do. They count their calls, and print them unless quiet.
+struct ble_link {
+    bool quiet = false;
+    std::uint64_t advertising_started = 0;
+    std::uint64_t advertising_stopped = 0;
+    std::uint64_t disconnects = 0;
+
+    void start_advertising() {
+        ++advertising_started;
+        if(!quiet) {
+            printf("Action: start_advertising()\n");
+        }
+    }
+    void stop_advertising() {
+        ++advertising_stopped;
+        if(!quiet) {
+            printf("Action: stop_advertising()\n");
+        }
+    }
+    void disconnect() {
+        ++disconnects;
+        if(!quiet) {
+            printf("Action: disconnect()\n");
+        }
+    }
+};
+
+using ble_fsm = fsm<ble_link,
+    row<ble_state::idle,        ble_event::ble_button_pressed, ble_state::advertising, &ble_link::start_advertising>,
+    row<ble_state::advertising, ble_event::connection_request, ble_state::connected>,
+    row<ble_state::advertising, ble_event::timer_expired,      ble_state::idle,        &ble_link::stop_advertising>,
+    row<ble_state::connected,   ble_event::ble_button_pressed, ble_state::idle,        &ble_link::disconnect>>;
+
+inline const char* state_to_string(ble_state state) {
+    switch (state) {
+        case ble_state::idle:        return "idle";
+        case ble_state::advertising: return "advertising";
+        case ble_state::connected:   return "connected";
+        default:                     return "unknown";
+    }
+}
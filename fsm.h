@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// One transition: in State, Event moves the machine to Next after running
+// Action. Action is a member function of the machine's context, a function
+// taking the context by reference, or nullptr for none.
+template <auto State, auto Event, auto Next, auto Action = nullptr>
+struct row {
+    static_assert(std::is_enum_v<decltype(State)> && std::is_enum_v<decltype(Event)>,
+                  "States and events must be enumerators");
+    static_assert(std::is_same_v<decltype(State), decltype(Next)>,
+                  "Next must be a state of the same enum");
+
+    static constexpr auto state = State;
+    static constexpr auto event = Event;
+    static constexpr auto next = Next;
+    static constexpr auto action = Action;
+};
+
+// A state machine declared as a list of rows. The rows are compiled into a
+// dense [state][event] table, so handle_event(e) is one lookup and at most
+// one indirect call; handle_event<E>() with an event known at compile time
+// only considers the rows for E and calls their actions directly. Events a
+// state has no row for are ignored.
+//
+// The context holds whatever the actions work on and lives inside the
+// machine.
+template <typename Context, typename... Rows>
+class fsm {
+    static_assert(sizeof...(Rows) > 0, "A machine needs at least one row");
+    using first_row = std::tuple_element_t<0, std::tuple<Rows...>>;
+
+    template <typename Enum>
+    static constexpr std::size_t index(Enum value) {
+        return static_cast<std::size_t>(value);
+    }
+
+public:
+    using state_type = std::remove_const_t<decltype(first_row::state)>;
+    using event_type = std::remove_const_t<decltype(first_row::event)>;
+    static constexpr state_type initial_state = first_row::state;
+
+    static_assert((std::is_same_v<state_type, std::remove_const_t<decltype(Rows::state)>> && ...),
+                  "All rows must use the same state enum");
+    static_assert((std::is_same_v<event_type, std::remove_const_t<decltype(Rows::event)>> && ...),
+                  "All rows must use the same event enum");
+
+    static constexpr std::size_t state_count =
+        std::max({index(Rows::state)..., index(Rows::next)...}) + 1;
+    static constexpr std::size_t event_count = std::max({index(Rows::event)...}) + 1;
+
+    template <typename... Args>
+    explicit fsm(state_type initial = initial_state, Args&&... args)
+        : context_(std::forward<Args>(args)...), state_{initial} {
+        if(index(initial) >= state_count) {
+            throw std::out_of_range{"Initial state has no transitions"};
+        }
+    }
+
+    state_type get_state() const { return state_; }
+    Context& context() { return context_; }
+    const Context& context() const { return context_; }
+
+    // Returns whether a transition was taken.
+    bool handle_event(event_type event) {
+        const auto e = index(event);
+        if(e >= event_count) {
+            return false;
+        }
+        const auto& entry = table_[index(state_) * event_count + e];
+        if(entry.action) {
+            entry.action(context_);
+        }
+        state_ = static_cast<state_type>(entry.next);
+        return entry.taken;
+    }
+
+    template <event_type Event>
+    bool handle_event() {
+        return (try_row<Rows, Event>() || ...);
+    }
+
+private:
+    using action_fn = void (*)(Context&);
+
+    template <auto Action>
+    static void call(Context& context) {
+        std::invoke(Action, context);
+    }
+
+    template <auto Action>
+    struct action_key {};
+
+    template <std::size_t I>
+    using row_at = std::tuple_element_t<I, std::tuple<Rows...>>;
+
+    template <typename Row>
+    static constexpr bool has_action = !std::is_null_pointer_v<decltype(Row::action)>;
+
+    // Actions are told apart by type rather than by address: an inline
+    // function's address may be taken in a constant expression, but not
+    // compared.
+    template <typename Row, auto Action>
+    static constexpr bool runs = std::is_same_v<action_key<Row::action>, action_key<Action>>;
+
+    template <typename Row>
+    static constexpr std::size_t first_row_running() {
+        return []<std::size_t... I>(std::index_sequence<I...>) {
+            std::size_t first = sizeof...(I);
+            ((first == sizeof...(I) && runs<row_at<I>, Row::action> ? first = I : 0), ...);
+            return first;
+        }(std::index_sequence_for<Rows...>{});
+    }
+
+    // 0 for none; the distinct actions are numbered from 1 in the order of
+    // the first row running each.
+    template <typename Row>
+    static constexpr std::size_t action_number() {
+        if constexpr (!has_action<Row>) {
+            return 0;
+        } else {
+            return []<std::size_t... I>(std::index_sequence<I...>) {
+                constexpr auto first = first_row_running<Row>();
+                return 1 + (std::size_t{I < first && has_action<row_at<I>> &&
+                                        first_row_running<row_at<I>>() == I} + ... + 0);
+            }(std::index_sequence_for<Rows...>{});
+        }
+    }
+
+public:
+    // The table as plain numbers, for engines that keep many instances side
+    // by side (see fsm_bank.h). Cell state * event_count + event holds the
+    // next state and the number of the action to run, 0 meaning none.
+    static constexpr std::size_t action_count =
+        std::max({std::size_t{0}, action_number<Rows>()...}) + 1;
+
+    // The number of Action, or 0 if no row runs it.
+    template <auto Action>
+    static constexpr std::size_t action_id = [] {
+        std::size_t id = 0;
+        ((id == 0 && runs<Rows, Action> ? id = action_number<Rows>() : 0), ...);
+        return id;
+    }();
+
+    static constexpr std::size_t next_state(std::size_t cell) { return table_[cell].next; }
+    static constexpr std::size_t action_at(std::size_t cell) { return table_[cell].action_id; }
+
+    static void run_action(std::size_t id, Context& context) {
+        if(id != 0) {
+            actions_[id](context);
+        }
+    }
+
+private:
+    using state_index = std::uint16_t;
+    static_assert(state_count <= std::numeric_limits<state_index>::max(), "Too many states");
+
+    // Cells without a row stay in their own state, so dispatch needs no
+    // branch to tell them apart.
+    struct entry {
+        state_index next;
+        bool taken;
+        std::uint8_t action_id;
+        action_fn action;
+    };
+    static_assert(action_count <= std::numeric_limits<std::uint8_t>::max(), "Too many actions");
+
+    static constexpr auto actions_ = [] {
+        std::array<action_fn, action_count> actions{};
+        ([&] {
+            if constexpr (has_action<Rows>) {
+                actions[action_number<Rows>()] = &call<Rows::action>;
+            }
+        }(), ...);
+        return actions;
+    }();
+
+    // Not constexpr, so reaching it while building the table is a
+    // compile-time error.
+    static void duplicate_transition() {}
+
+    template <typename Row>
+    static constexpr void add(std::array<entry, state_count * event_count>& table) {
+        auto& slot = table[index(Row::state) * event_count + index(Row::event)];
+        if(slot.taken) {
+            duplicate_transition();
+        }
+        slot.next = static_cast<state_index>(index(Row::next));
+        slot.taken = true;
+        slot.action_id = static_cast<std::uint8_t>(action_number<Row>());
+        slot.action = actions_[slot.action_id];
+    }
+
+    static constexpr auto table_ = [] {
+        std::array<entry, state_count * event_count> table{};
+        for(std::size_t i = 0; i < table.size(); ++i) {
+            table[i] = {static_cast<state_index>(i / event_count), false, 0, nullptr};
+        }
+        (add<Rows>(table), ...);
+        return table;
+    }();
+
+    template <typename Row, event_type Event>
+    bool try_row() {
+        if constexpr (Row::event == Event) {
+            if(state_ == Row::state) {
+                if constexpr (!std::is_null_pointer_v<decltype(Row::action)>) {
+                    std::invoke(Row::action, context_);
+                }
+                state_ = Row::next;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Context context_;
+    state_type state_;
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "fsm.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#if __has_include(<experimental/simd>) && !defined(FSM_SCALAR)
+#include <experimental/simd>
+#define FSM_BANK_SIMD 1
+#endif
+
+// Many independent instances of one fsm<> machine, stored as one byte of
+// state each instead of one machine object each.
+//
+// Actions are not run as events are applied. Instead each action gets a
+// list of the instances that took a transition with it, to be handled in
+// bulk afterwards (or passed to Machine::run_action one by one).
+//
+// Only broadcast() is vectorized. apply() is a scalar loop by design: a
+// batch may name one instance several times, and a gather/scatter over
+// such a batch would lose all but one of its events. Finding the runs of
+// distinct instances needs a conflict check per vector that costs more
+// than the single table lookup it would save, and the loop is bound by its
+// random accesses to states_ anyway.
+template <typename Machine>
+class fsm_bank {
+    static_assert(Machine::state_count <= 16 && Machine::event_count <= 16 &&
+                  Machine::action_count <= 16,
+                  "States, events and actions must each fit in four bits");
+
+public:
+    using state_type = typename Machine::state_type;
+    using event_type = typename Machine::event_type;
+
+    struct input {
+        std::uint32_t instance;
+        event_type event;
+    };
+
+    // The default for the on_change hooks below: nothing to report.
+    struct ignore_changes {
+        void operator()(std::uint32_t, event_type, state_type, state_type) const {}
+    };
+
+    explicit fsm_bank(std::size_t instances, state_type initial = Machine::initial_state)
+        : states_(instances, static_cast<std::uint8_t>(initial)) {}
+
+    std::size_t size() const { return states_.size(); }
+    state_type state(std::uint32_t instance) const {
+        return static_cast<state_type>(states_[instance]);
+    }
+
+    // The state of every instance, one byte each, e.g. for snapshots (see
+    // fsm_journal.h).
+    std::span<const std::uint8_t> raw_states() const { return states_; }
+    std::span<std::uint8_t> raw_states() { return states_; }
+
+    // Applies the events in order; an instance may appear any number of
+    // times. One scalar table lookup per event, no calls. on_change(instance,
+    // event, from, to) is called for every event that changes a state.
+    template <typename OnChange = ignore_changes>
+    void apply(std::span<const input> batch, OnChange&& on_change = {}) {
+        auto* states = states_.data();
+        for(const auto& in: batch) {
+            auto& state = states[in.instance];
+            const auto packed = lut_[state << 4 | (static_cast<std::size_t>(in.event) & 0x0f)];
+            if constexpr (reports<OnChange>) {
+                if((packed & 0x0f) != state) {
+                    on_change(in.instance, in.event, static_cast<state_type>(state),
+                              static_cast<state_type>(packed & 0x0f));
+                }
+            }
+            state = packed & 0x0f;
+            if(const auto action = packed >> 4) {
+                performed_[action].push_back(in.instance);
+            }
+        }
+    }
+
+    // Applies one event to every instance, many instances per instruction
+    // where SIMD is available: the lookup becomes a compare-and-select for
+    // each state.
+    template <typename OnChange = ignore_changes>
+    void broadcast(event_type event, OnChange&& on_change = {}) {
+        std::array<std::uint8_t, Machine::state_count> next{};
+        std::array<std::uint8_t, Machine::state_count> action{};
+        bool any_action = false;
+        for(std::size_t s = 0; s < Machine::state_count; ++s) {
+            const auto packed = lut_[s << 4 | static_cast<std::size_t>(event)];
+            next[s] = packed & 0x0f;
+            action[s] = packed >> 4;
+            any_action |= action[s] != 0;
+        }
+        auto* states = states_.data();
+        std::size_t i = 0;
+#ifdef FSM_BANK_SIMD
+        namespace stdx = std::experimental;
+        using bytes = stdx::native_simd<std::uint8_t>;
+        for(; i + bytes::size() <= states_.size(); i += bytes::size()) {
+            const bytes current{states + i, stdx::element_aligned};
+            bytes updated = current;
+            bytes performed = 0;
+            for(std::size_t s = 0; s < Machine::state_count; ++s) {
+                const auto in_state = current == static_cast<std::uint8_t>(s);
+                stdx::where(in_state, updated) = next[s];
+                stdx::where(in_state, performed) = action[s];
+            }
+            updated.copy_to(states + i, stdx::element_aligned);
+            if constexpr (reports<OnChange>) {
+                if(stdx::any_of(updated != current)) {
+                    for(std::size_t lane = 0; lane < bytes::size(); ++lane) {
+                        if(updated[lane] != current[lane]) {
+                            on_change(static_cast<std::uint32_t>(i + lane), event,
+                                      static_cast<state_type>(current[lane]),
+                                      static_cast<state_type>(updated[lane]));
+                        }
+                    }
+                }
+            }
+            if(any_action && stdx::any_of(performed != 0)) {
+                for(std::size_t lane = 0; lane < bytes::size(); ++lane) {
+                    if(performed[lane] != 0) {
+                        performed_[performed[lane]].push_back(static_cast<std::uint32_t>(i + lane));
+                    }
+                }
+            }
+        }
+#endif
+        for(; i < states_.size(); ++i) {
+            const auto s = states[i];
+            states[i] = next[s];
+            if constexpr (reports<OnChange>) {
+                if(next[s] != s) {
+                    on_change(static_cast<std::uint32_t>(i), event, static_cast<state_type>(s),
+                              static_cast<state_type>(next[s]));
+                }
+            }
+            if(action[s] != 0) {
+                performed_[action[s]].push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+
+    // The instances that ran Action since the last clear_performed(), in
+    // the order they ran it.
+    template <auto Action>
+    std::span<const std::uint32_t> performed() const {
+        static_assert(Machine::template action_id<Action> != 0, "No row runs this action");
+        return performed_[Machine::template action_id<Action>];
+    }
+
+    void clear_performed() {
+        for(auto& list: performed_) {
+            list.clear();
+        }
+    }
+
+private:
+    template <typename OnChange>
+    static constexpr bool reports = !std::is_same_v<std::decay_t<OnChange>, ignore_changes>;
+
+    // next state | action << 4, indexed by state << 4 | event. Cells
+    // outside the machine's table keep their state and run nothing.
+    static constexpr auto lut_ = [] {
+        std::array<std::uint8_t, 256> lut{};
+        for(std::size_t s = 0; s < 16; ++s) {
+            for(std::size_t e = 0; e < 16; ++e) {
+                std::uint8_t packed = static_cast<std::uint8_t>(s);
+                if(s < Machine::state_count && e < Machine::event_count) {
+                    const auto cell = s * Machine::event_count + e;
+                    packed = static_cast<std::uint8_t>(Machine::next_state(cell) |
+                                                       Machine::action_at(cell) << 4);
+                }
+                lut[s << 4 | e] = packed;
+            }
+        }
+        return lut;
+    }();
+
+    std::vector<std::uint8_t> states_;
+    std::array<std::vector<std::uint32_t>, Machine::action_count> performed_;
+};
@@ -0,0 +1,707 @@
+// Events per second through each implementation of the BLE state machine.
+//
+// Build: g++ -std=c++20 -O2 fsm_benchmark.cpp
+// Run:   ./a.out [dispatch|bank|timers|runtime|journal]
+//        (no argument runs everything)
+//
+// 'dispatch' feeds the same pseudo-random event stream to the switch
+// (fsm_simple.cpp), state pattern (fsm_state_pattern.cpp), tag dispatch
+// (fsm_state_pattern_tag_dispatch.cpp), hierarchical (hsm.h) and
+// table-driven (fsm.h) machines.
+// It exits non-zero if they do not end in the same state with the same
+// actions taken.
+// 'bank' drives millions of BLE sessions once as ble_fsm objects and once
+// as an fsm_bank, and exits non-zero if the two end up different.
+// 'timers' runs advertising timeouts for a million sessions on a timer
+// wheel with a virtual clock, and exits non-zero if a timeout is lost,
+// fires for a session that connected, or survives a restart of the state.
+// 'runtime' posts 100M events to a million sessions sharded over 1, 2, 4
+// ... hardware_concurrency() pool workers, with as many posting tasks,
+// and exits non-zero if any session ends up unlike a sequential replay.
+// 'journal' runs a bank of 4M sessions with every state change journaled,
+// snapshots it halfway, then recovers the states from the files and exits
+// non-zero if they differ from the bank's.
+#include "ble_fsm.h"
+#include "fsm_bank.h"
+#include "fsm_journal.h"
+#include "fsm_runtime.h"
+#include "hsm.h"
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr std::size_t stream_length = 1 << 16;
+constexpr std::size_t stream_repeats = 800;
+
+// fsm_simple.cpp
+class switch_fsm {
+public:
+    void handle_event(ble_event event) {
+        switch (current_state_) {
+            case ble_state::idle:
+                if (event == ble_event::ble_button_pressed) {
+                    link_.start_advertising();
+                    current_state_ = ble_state::advertising;
+                }
+                break;
+            case ble_state::advertising:
+                if (event == ble_event::connection_request) {
+                    current_state_ = ble_state::connected;
+                } else if (event == ble_event::timer_expired) {
+                    link_.stop_advertising();
+                    current_state_ = ble_state::idle;
+                }
+                break;
+            case ble_state::connected:
+                if (event == ble_event::ble_button_pressed) {
+                    link_.disconnect();
+                    current_state_ = ble_state::idle;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    ble_state get_state() const { return current_state_; }
+    ble_link& context() { return link_; }
+private:
+    ble_state current_state_ = ble_state::idle;
+    ble_link link_{.quiet = true};
+};
+
+// fsm_state_pattern.cpp: one object per state, looked up on every event.
+namespace state_pattern {
+
+class state {
+public:
+    virtual ~state() = default;
+    virtual ble_state handle_event(ble_event event) = 0;
+    virtual ble_state get_state_enum() = 0;
+};
+
+class idle : public state {
+public:
+    explicit idle(ble_link& link) : link_{link} {}
+    ble_state handle_event(ble_event event) override {
+        if (event == ble_event::ble_button_pressed) {
+            link_.start_advertising();
+            return ble_state::advertising;
+        }
+        return get_state_enum();
+    }
+    ble_state get_state_enum() override { return ble_state::idle; }
+private:
+    ble_link& link_;
+};
+
+class advertising : public state {
+public:
+    explicit advertising(ble_link& link) : link_{link} {}
+    ble_state handle_event(ble_event event) override {
+        if (event == ble_event::connection_request) {
+            return ble_state::connected;
+        }
+        if (event == ble_event::timer_expired) {
+            link_.stop_advertising();
+            return ble_state::idle;
+        }
+        return get_state_enum();
+    }
+    ble_state get_state_enum() override { return ble_state::advertising; }
+private:
+    ble_link& link_;
+};
+
+class connected : public state {
+public:
+    explicit connected(ble_link& link) : link_{link} {}
+    ble_state handle_event(ble_event event) override {
+        if (event == ble_event::ble_button_pressed) {
+            link_.disconnect();
+            return ble_state::idle;
+        }
+        return get_state_enum();
+    }
+    ble_state get_state_enum() override { return ble_state::connected; }
+private:
+    ble_link& link_;
+};
+
+class machine {
+public:
+    machine() : states_{&idle_, &advertising_, &connected_} {}
+    void handle_event(ble_event event) {
+        if(auto the_state = get_the_state(current_state_)) {
+            current_state_ = the_state->handle_event(event);
+        }
+    }
+    ble_state get_state() const { return current_state_; }
+    ble_link& context() { return link_; }
+private:
+    ble_link link_{.quiet = true};
+    idle idle_{link_};
+    advertising advertising_{link_};
+    connected connected_{link_};
+    std::vector<state*> states_;
+    ble_state current_state_ = ble_state::idle;
+
+    state* get_the_state(ble_state state_enum) {
+        auto it = std::find_if(states_.begin(), states_.end(), [&](state* the_state) {
+            return the_state->get_state_enum() == state_enum;
+        });
+        return it != states_.end() ? *it : nullptr;
+    }
+};
+
+} // namespace state_pattern
+
+// fsm_state_pattern_tag_dispatch.cpp: one virtual overload per event type.
+namespace tag_dispatch {
+
+struct ble_button_pressed {};
+struct connection_request {};
+struct timer_expired {};
+
+class state {
+public:
+    virtual ~state() = default;
+    virtual ble_state handle_event(ble_button_pressed) { return get_state_enum(); }
+    virtual ble_state handle_event(connection_request) { return get_state_enum(); }
+    virtual ble_state handle_event(timer_expired) { return get_state_enum(); }
+    virtual ble_state get_state_enum() = 0;
+};
+
+class idle : public state {
+public:
+    explicit idle(ble_link& link) : link_{link} {}
+    using state::handle_event;
+    ble_state handle_event(ble_button_pressed) override {
+        link_.start_advertising();
+        return ble_state::advertising;
+    }
+    ble_state get_state_enum() override { return ble_state::idle; }
+private:
+    ble_link& link_;
+};
+
+class advertising : public state {
+public:
+    explicit advertising(ble_link& link) : link_{link} {}
+    using state::handle_event;
+    ble_state handle_event(connection_request) override { return ble_state::connected; }
+    ble_state handle_event(timer_expired) override {
+        link_.stop_advertising();
+        return ble_state::idle;
+    }
+    ble_state get_state_enum() override { return ble_state::advertising; }
+private:
+    ble_link& link_;
+};
+
+class connected : public state {
+public:
+    explicit connected(ble_link& link) : link_{link} {}
+    using state::handle_event;
+    ble_state handle_event(ble_button_pressed) override {
+        link_.disconnect();
+        return ble_state::idle;
+    }
+    ble_state get_state_enum() override { return ble_state::connected; }
+private:
+    ble_link& link_;
+};
+
+class machine {
+public:
+    machine() : states_{&idle_, &advertising_, &connected_} {}
+    template<typename E>
+    void handle_event(E event) {
+        if(auto the_state = get_the_state(current_state_)) {
+            current_state_ = the_state->handle_event(event);
+        }
+    }
+    ble_state get_state() const { return current_state_; }
+    ble_link& context() { return link_; }
+private:
+    ble_link link_{.quiet = true};
+    idle idle_{link_};
+    advertising advertising_{link_};
+    connected connected_{link_};
+    std::vector<state*> states_;
+    ble_state current_state_ = ble_state::idle;
+
+    state* get_the_state(ble_state state_enum) {
+        auto it = std::find_if(states_.begin(), states_.end(), [&](state* the_state) {
+            return the_state->get_state_enum() == state_enum;
+        });
+        return it != states_.end() ? *it : nullptr;
+    }
+};
+
+} // namespace tag_dispatch
+
+// The tag dispatch machine on hsm.h, with advertising and connected inside
+// a session state. Nothing is deferred, so it behaves like the others.
+namespace hierarchical {
+
+using tag_dispatch::ble_button_pressed;
+using tag_dispatch::connection_request;
+using tag_dispatch::timer_expired;
+
+struct idle;
+struct advertising;
+struct connected;
+
+struct idle {
+    static transition_to<advertising> on(ble_button_pressed, ble_link& link) {
+        link.start_advertising();
+        return {};
+    }
+};
+
+struct session {
+    using initial = advertising;
+};
+
+struct advertising {
+    using parent = session;
+    static transition_to<connected> on(connection_request, ble_link&) { return {}; }
+    static transition_to<idle> on(timer_expired, ble_link& link) {
+        link.stop_advertising();
+        return {};
+    }
+};
+
+struct connected {
+    using parent = session;
+    static transition_to<idle> on(ble_button_pressed, ble_link& link) {
+        link.disconnect();
+        return {};
+    }
+};
+
+class machine {
+public:
+    template<typename E>
+    void handle_event(E event) { hsm_.dispatch(event); }
+    ble_state get_state() const {
+        if(hsm_.is_in<idle>()) {
+            return ble_state::idle;
+        }
+        return hsm_.is_in<advertising>() ? ble_state::advertising : ble_state::connected;
+    }
+    ble_link& context() { return hsm_.context(); }
+private:
+    hsm<ble_link, idle, states<idle, advertising, connected>,
+        events<ble_button_pressed, connection_request, timer_expired>> hsm_;
+};
+
+} // namespace hierarchical
+
+struct outcome {
+    ble_state state;
+    std::uint64_t started;
+    std::uint64_t stopped;
+    std::uint64_t disconnects;
+
+    bool operator==(const outcome&) const = default;
+};
+
+template <typename Machine, typename Dispatch>
+outcome run(const char* name, const std::vector<ble_event>& stream, Dispatch&& dispatch) {
+    Machine machine;
+    machine.context().quiet = true;
+    const auto start = bench_clock::now();
+    for(std::size_t r = 0; r < stream_repeats; ++r) {
+        for(auto event: stream) {
+            dispatch(machine, event);
+        }
+    }
+    const auto seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    const double events = static_cast<double>(stream.size() * stream_repeats);
+    printf("%-28s %8.1f M events/s %6.2f ns/event\n", name, events / seconds / 1e6,
+           seconds * 1e9 / events);
+    const auto& link = machine.context();
+    return {machine.get_state(), link.advertising_started, link.advertising_stopped,
+            link.disconnects};
+}
+
+bool bench_dispatch() {
+    std::vector<ble_event> stream(stream_length);
+    std::uint32_t seed = 7;
+    for(auto& event: stream) {
+        seed = seed * 1664525u + 1013904223u;
+        event = static_cast<ble_event>((seed >> 16) % 3);
+    }
+    printf("dispatch: %zu pseudo-random events\n", stream_length * stream_repeats);
+
+    const auto plain = [](auto& machine, ble_event event) { machine.handle_event(event); };
+    const std::vector<outcome> outcomes{
+        run<switch_fsm>("switch", stream, plain),
+        run<state_pattern::machine>("state pattern", stream, plain),
+        run<tag_dispatch::machine>("tag dispatch", stream,
+            [](tag_dispatch::machine& machine, ble_event event) {
+                switch(event) {
+                    case ble_event::ble_button_pressed:
+                        machine.handle_event(tag_dispatch::ble_button_pressed{});
+                        break;
+                    case ble_event::connection_request:
+                        machine.handle_event(tag_dispatch::connection_request{});
+                        break;
+                    case ble_event::timer_expired:
+                        machine.handle_event(tag_dispatch::timer_expired{});
+                        break;
+                }
+            }),
+        run<hierarchical::machine>("hierarchical (hsm.h)", stream,
+            [](hierarchical::machine& machine, ble_event event) {
+                switch(event) {
+                    case ble_event::ble_button_pressed:
+                        machine.handle_event(hierarchical::ble_button_pressed{});
+                        break;
+                    case ble_event::connection_request:
+                        machine.handle_event(hierarchical::connection_request{});
+                        break;
+                    case ble_event::timer_expired:
+                        machine.handle_event(hierarchical::timer_expired{});
+                        break;
+                }
+            }),
+        run<ble_fsm>("table (handle_event(e))", stream, plain),
+        run<ble_fsm>("direct (handle_event<E>())", stream,
+            [](ble_fsm& machine, ble_event event) {
+                switch(event) {
+                    case ble_event::ble_button_pressed:
+                        machine.handle_event<ble_event::ble_button_pressed>();
+                        break;
+                    case ble_event::connection_request:
+                        machine.handle_event<ble_event::connection_request>();
+                        break;
+                    case ble_event::timer_expired:
+                        machine.handle_event<ble_event::timer_expired>();
+                        break;
+                }
+            }),
+    };
+    const bool same = std::all_of(outcomes.begin(), outcomes.end(),
+                                  [&](const outcome& o) { return o == outcomes.front(); });
+    if(!same) {
+        printf("FAIL: the machines disagree\n");
+    }
+    return same;
+}
+
+constexpr std::size_t bank_instances = 2'000'000;
+constexpr std::size_t bank_events = 8'000'000;
+
+double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+bool bench_bank() {
+    using bank_type = fsm_bank<ble_fsm>;
+    std::vector<bank_type::input> batch(bank_events);
+    std::uint32_t seed = 11;
+    for(auto& in: batch) {
+        seed = seed * 1664525u + 1013904223u;
+        in.instance = (seed >> 8) % bank_instances;
+        seed = seed * 1664525u + 1013904223u;
+        in.event = static_cast<ble_event>((seed >> 16) % 3);
+    }
+    printf("bank: %zu sessions, %zu events, then timer_expired to all\n",
+           bank_instances, bank_events);
+
+    std::vector<ble_fsm> objects(bank_instances);
+    for(auto& object: objects) {
+        object.context().quiet = true;
+    }
+    auto start = bench_clock::now();
+    for(const auto& in: batch) {
+        objects[in.instance].handle_event(in.event);
+    }
+    const auto object_seconds = seconds_since(start);
+    start = bench_clock::now();
+    for(auto& object: objects) {
+        object.handle_event(ble_event::timer_expired);
+    }
+    const auto object_broadcast = seconds_since(start);
+
+    bank_type bank{bank_instances};
+    start = bench_clock::now();
+    bank.apply(batch);
+    const auto bank_seconds = seconds_since(start);
+    const auto started = bank.performed<&ble_link::start_advertising>().size();
+    const auto disconnects = bank.performed<&ble_link::disconnect>().size();
+    start = bench_clock::now();
+    bank.broadcast(ble_event::timer_expired);
+    const auto bank_broadcast = seconds_since(start);
+    const auto stopped = bank.performed<&ble_link::stop_advertising>().size();
+
+    printf("%-10s %3zu bytes/session %8.1f M events/s  broadcast %6.2f ms\n",
+           "objects", sizeof(ble_fsm), bank_events / object_seconds / 1e6,
+           object_broadcast * 1e3);
+    printf("%-10s %3d bytes/session %8.1f M events/s  broadcast %6.2f ms\n",
+           "bank", 1, bank_events / bank_seconds / 1e6, bank_broadcast * 1e3);
+
+    std::uint64_t object_started = 0;
+    std::uint64_t object_stopped = 0;
+    std::uint64_t object_disconnects = 0;
+    bool same = true;
+    for(std::uint32_t i = 0; i < bank_instances; ++i) {
+        const auto& link = objects[i].context();
+        object_started += link.advertising_started;
+        object_stopped += link.advertising_stopped;
+        object_disconnects += link.disconnects;
+        same = same && objects[i].get_state() == bank.state(i);
+    }
+    same = same && object_started == started && object_stopped == stopped &&
+           object_disconnects == disconnects;
+    if(!same) {
+        printf("FAIL: the bank and the objects disagree\n");
+    }
+    return same;
+}
+
+constexpr std::size_t timer_sessions = 1'000'000;
+constexpr std::uint64_t advertising_timeout = 30'000;
+
+// Pressing the button while advertising restarts advertising, so the
+// timeout has to start over rather than keep its old deadline.
+using restartable_fsm = fsm<ble_link,
+    row<ble_state::advertising, ble_event::ble_button_pressed, ble_state::advertising, &ble_link::start_advertising>,
+    row<ble_state::advertising, ble_event::timer_expired,      ble_state::idle,        &ble_link::stop_advertising>>;
+
+bool check_restart() {
+    timer_wheel wheel{std::chrono::milliseconds{1}, timer_wheel::clock_mode::manual};
+    fsm_timeouts<restartable_fsm, ble_state::advertising, ble_event::timer_expired> sessions{
+        1, wheel, advertising_timeout};
+    sessions.machine(0).context().quiet = true;
+    sessions.advance(advertising_timeout - 10);
+    sessions.handle_event(0, ble_event::ble_button_pressed);
+    const auto early = sessions.advance(20);
+    const bool kept = sessions.machine(0).get_state() == ble_state::advertising;
+    const auto late = sessions.advance(advertising_timeout);
+    return early == 0 && kept && late == 1 && wheel.size() == 0 &&
+           sessions.machine(0).get_state() == ble_state::idle;
+}
+
+bool bench_timers() {
+    using timed_sessions = fsm_timeouts<ble_fsm, ble_state::advertising, ble_event::timer_expired>;
+    printf("timers: %zu sessions, advertising timeout %llu ticks, virtual clock\n",
+           timer_sessions, static_cast<unsigned long long>(advertising_timeout));
+    timer_wheel wheel{std::chrono::milliseconds{1}, timer_wheel::clock_mode::manual};
+    timed_sessions sessions{timer_sessions, wheel, advertising_timeout};
+    for(std::uint32_t i = 0; i < timer_sessions; ++i) {
+        sessions.machine(i).context().quiet = true;
+    }
+
+    // Sessions start advertising in 100 waves, 250 ticks apart, so timers
+    // land on every level of the wheel.
+    constexpr std::size_t waves = 100;
+    auto start = bench_clock::now();
+    std::size_t fired = 0;
+    for(std::size_t wave = 0; wave < waves; ++wave) {
+        for(auto i = wave; i < timer_sessions; i += waves) {
+            sessions.handle_event(static_cast<std::uint32_t>(i), ble_event::ble_button_pressed);
+        }
+        fired += sessions.advance(250);
+    }
+    const auto arm_seconds = seconds_since(start);
+
+    // Every third session connects, which cancels its timer.
+    start = bench_clock::now();
+    for(std::uint32_t i = 0; i < timer_sessions; i += 3) {
+        sessions.handle_event(i, ble_event::connection_request);
+    }
+    const auto cancel_seconds = seconds_since(start);
+
+    start = bench_clock::now();
+    fired += sessions.advance(advertising_timeout);
+    const auto expire_seconds = seconds_since(start);
+
+    const std::size_t connected = (timer_sessions + 2) / 3;
+    printf("%-8s %8.1f M/s\n", "arm", timer_sessions / arm_seconds / 1e6);
+    printf("%-8s %8.1f M/s\n", "cancel", connected / cancel_seconds / 1e6);
+    printf("%-8s %8.1f M/s (%zu fired)\n", "expire", fired / expire_seconds / 1e6, fired);
+
+    bool ok = fired == timer_sessions - connected && wheel.size() == 0;
+    for(std::uint32_t i = 0; i < timer_sessions && ok; ++i) {
+        const auto expected = i % 3 == 0 ? ble_state::connected : ble_state::idle;
+        ok = sessions.machine(i).get_state() == expected &&
+             sessions.machine(i).context().advertising_stopped == (i % 3 != 0);
+    }
+    if(!ok) {
+        printf("FAIL: timeouts do not match the sessions\n");
+    }
+    if(!check_restart()) {
+        printf("FAIL: re-entering the state kept the old deadline\n");
+        ok = false;
+    }
+    return ok;
+}
+
+constexpr std::size_t runtime_instances = 1'000'000;
+constexpr std::size_t runtime_events = 100'000'000;
+
+// Poster p sends its share of the events to its own range of sessions, so
+// every session's events come from one thread and their order is fixed.
+template <typename Post>
+void post_share(std::size_t p, std::size_t posters, Post&& post) {
+    const auto first = runtime_instances * p / posters;
+    const auto count = runtime_instances * (p + 1) / posters - first;
+    std::uint32_t seed = static_cast<std::uint32_t>(p) + 1;
+    for(std::size_t e = p; e < runtime_events; e += posters) {
+        seed = seed * 1664525u + 1013904223u;
+        const auto instance = static_cast<std::uint32_t>(first + (seed >> 4) % count);
+        seed = seed * 1664525u + 1013904223u;
+        post(instance, static_cast<ble_event>((seed >> 16) % 3));
+    }
+}
+
+bool bench_runtime() {
+    printf("runtime: %zu sessions, %zu events\n", runtime_instances, runtime_events);
+    const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+    const ble_fsm prototype{ble_fsm::initial_state, true};
+    bool ok = true;
+    for(std::size_t threads = 1;; threads = std::min<std::size_t>(threads * 2, hardware)) {
+        thread_pool::ThreadPool pool{threads};
+        fsm_runtime<ble_fsm> runtime{pool, runtime_instances, prototype};
+        const auto start = bench_clock::now();
+        pool.parallel_for(std::size_t{0}, threads, 1, [&](std::size_t p) {
+            post_share(p, threads, [&](std::uint32_t instance, ble_event event) {
+                runtime.post(instance, event);
+            });
+        });
+        runtime.drain();
+        const auto seconds = seconds_since(start);
+        printf("%2zu threads %4zu shards %8.1f M events/s\n", threads, runtime.shards(),
+               runtime_events / seconds / 1e6);
+
+        std::vector<ble_fsm> reference(runtime_instances, prototype);
+        for(std::size_t p = 0; p < threads; ++p) {
+            post_share(p, threads, [&](std::uint32_t instance, ble_event event) {
+                reference[instance].handle_event(event);
+            });
+        }
+        for(std::uint32_t i = 0; i < runtime_instances; ++i) {
+            const auto& mine = runtime.machine(i);
+            const auto& theirs = reference[i];
+            ok = ok && mine.get_state() == theirs.get_state() &&
+                 mine.context().advertising_started == theirs.context().advertising_started &&
+                 mine.context().disconnects == theirs.context().disconnects;
+        }
+        if(threads == hardware) {
+            break;
+        }
+    }
+    if(!ok) {
+        printf("FAIL: sessions differ from the sequential replay\n");
+    }
+    return ok;
+}
+
+constexpr std::size_t journal_instances = 4'000'000;
+constexpr std::size_t journal_batches = 16;
+constexpr std::size_t journal_batch = 1'000'000;
+
+bool bench_journal() {
+    using bank_type = fsm_bank<ble_fsm>;
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto journal_path = (dir / "fsm_benchmark.journal").string();
+    const auto snapshot_path = (dir / "fsm_benchmark.snapshot").string();
+    std::filesystem::remove(journal_path);
+    std::filesystem::remove(snapshot_path);
+    printf("journal: %zu sessions, %zu events, snapshot after %zu\n", journal_instances,
+           journal_batches * journal_batch, journal_batches / 2 * journal_batch);
+
+    std::vector<bank_type::input> batch(journal_batch);
+    std::uint32_t seed = 13;
+    const auto refill = [&] {
+        for(auto& in: batch) {
+            seed = seed * 1664525u + 1013904223u;
+            in.instance = (seed >> 4) % journal_instances;
+            seed = seed * 1664525u + 1013904223u;
+            in.event = static_cast<ble_event>((seed >> 16) % 3);
+        }
+    };
+
+    bank_type bank{journal_instances};
+    double apply_seconds = 0;
+    double snapshot_seconds = 0;
+    {
+        fsm_journal journal{journal_path, {.group_size = 1 << 16}};
+        for(std::size_t b = 0; b < journal_batches; ++b) {
+            refill();
+            auto start = bench_clock::now();
+            bank.apply(batch, journal);
+            apply_seconds += seconds_since(start);
+            if(b + 1 == journal_batches / 2) {
+                start = bench_clock::now();
+                journal.snapshot(snapshot_path, bank.raw_states());
+                snapshot_seconds = seconds_since(start);
+            }
+        }
+        refill();
+        bank_type plain{journal_instances};
+        const auto start = bench_clock::now();
+        plain.apply(batch);
+        const auto plain_seconds = seconds_since(start);
+        printf("%-22s %8.1f M events/s\n", "apply", journal_batch / plain_seconds / 1e6);
+        printf("%-22s %8.1f M events/s  (%llu changes)\n", "apply + journal",
+               journal_batches * journal_batch / apply_seconds / 1e6,
+               static_cast<unsigned long long>(journal.position()));
+        printf("%-22s %8.2f ms\n", "snapshot", snapshot_seconds * 1e3);
+        journal.close();
+    }
+
+    std::vector<std::uint8_t> states(journal_instances,
+                                     static_cast<std::uint8_t>(ble_fsm::initial_state));
+    const auto start = bench_clock::now();
+    const auto recovered = recover(snapshot_path, journal_path, states);
+    printf("%-22s %8.2f ms  (%llu records replayed)\n", "recover", seconds_since(start) * 1e3,
+           static_cast<unsigned long long>(recovered.replayed));
+    std::filesystem::remove(journal_path);
+    std::filesystem::remove(snapshot_path);
+
+    const auto expected = bank.raw_states();
+    const bool same = std::equal(states.begin(), states.end(), expected.begin(), expected.end());
+    if(!same) {
+        printf("FAIL: the recovered states differ from the bank\n");
+    }
+    return same;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto selected = [&](const char* section) {
+        return argc < 2 || 0 == strcmp(argv[1], section);
+    };
+    if(selected("dispatch") && !bench_dispatch()) {
+        return 1;
+    }
+    if(selected("bank") && !bench_bank()) {
+        return 1;
+    }
+    if(selected("timers") && !bench_timers()) {
+        return 1;
+    }
+    if(selected("runtime") && !bench_runtime()) {
+        return 1;
+    }
+    if(selected("journal") && !bench_journal()) {
+        return 1;
+    }
+    return 0;
+}
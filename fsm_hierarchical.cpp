@@ -0,0 +1,97 @@
+#include "ble_fsm.h"
+#include "hsm.h"
+
+#include <cstdio>
+
+// The BLE machine with event tag types, as a hierarchical machine: while
+// advertising or connected the link is in a session, and a connection
+// request that arrives before advertising started waits for it.
+
+struct ble_button_pressed{};
+struct connection_request{};
+struct timer_expired{};
+
+struct idle;
+struct session;
+struct advertising;
+struct connected;
+
+struct idle {
+    static transition_to<advertising> on(ble_button_pressed, ble_link& link) {
+        link.start_advertising();
+        return {};
+    }
+    static defer_event on(connection_request, ble_link&) {
+        return {};
+    }
+};
+
+struct session {
+    using initial = advertising;
+
+    static void entry(ble_link& link) {
+        if(!link.quiet) {
+            printf("Entry: session\n");
+        }
+    }
+    static void exit(ble_link& link) {
+        if(!link.quiet) {
+            printf("Exit: session\n");
+        }
+    }
+};
+
+struct advertising {
+    using parent = session;
+
+    static transition_to<connected> on(connection_request, ble_link&) {
+        return {};
+    }
+    static transition_to<idle> on(timer_expired, ble_link& link) {
+        link.stop_advertising();
+        return {};
+    }
+};
+
+struct connected {
+    using parent = session;
+
+    static transition_to<idle> on(ble_button_pressed, ble_link& link) {
+        link.disconnect();
+        return {};
+    }
+};
+
+using ble_hsm = hsm<ble_link, idle,
+                    states<idle, advertising, connected>,
+                    events<ble_button_pressed, connection_request, timer_expired>>;
+
+namespace {
+const char* state_to_string(const ble_hsm& machine) {
+    if(machine.is_in<idle>())        return "idle";
+    if(machine.is_in<advertising>()) return "advertising";
+    if(machine.is_in<connected>())   return "connected";
+    return "unknown";
+}
+}
+
+int main() {
+    ble_hsm my_ble_fsm;
+    const auto print_current_state = [&]() {
+        printf("Current State: %s\n", state_to_string(my_ble_fsm));
+    };
+    print_current_state();
+    my_ble_fsm.dispatch(connection_request{});
+    printf("Deferred events: %zu\n", my_ble_fsm.deferred());
+    my_ble_fsm.dispatch(ble_button_pressed{});
+    print_current_state();
+    my_ble_fsm.dispatch(ble_button_pressed{});
+    print_current_state();
+    my_ble_fsm.dispatch(ble_button_pressed{});
+    print_current_state();
+    my_ble_fsm.dispatch(timer_expired{});
+    print_current_state();
+    while(true)
+    {
+    }
+}
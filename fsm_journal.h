@@ -0,0 +1,476 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Durable state for a fleet of machines kept one byte per instance (see
+// fsm_bank.h): an append-only journal of state changes plus snapshots of
+// the whole state array.
+//
+// Changes are buffered and written in groups, one write() and one
+// fdatasync() per group, so a crash loses at most the changes since the
+// last commit(). A snapshot records how far into the journal it reaches;
+// recovery maps the latest one and replays only the journal after it.
+// Replay sets each recorded instance to its recorded target state, so
+// actions are not run a second time. Taking a snapshot also starts a new
+// journal, so the journal only ever holds the changes since the last one.
+
+namespace journal_detail {
+
+// CRC-32C (Castagnoli), bitwise-reflected, one table lookup per byte.
+inline constexpr auto crc_table = [] {
+    std::array<std::uint32_t, 256> table{};
+    for(std::uint32_t i = 0; i < 256; ++i) {
+        auto crc = i;
+        for(int bit = 0; bit < 8; ++bit) {
+            crc = crc >> 1 ^ (crc & 1 ? 0x82f63b78u : 0);
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+inline std::uint32_t crc32c(const void* data, std::size_t size) {
+    auto* bytes = static_cast<const unsigned char*>(data);
+    std::uint32_t crc = 0xffffffff;
+    for(std::size_t i = 0; i < size; ++i) {
+        crc = crc >> 8 ^ crc_table[(crc ^ bytes[i]) & 0xff];
+    }
+    return ~crc;
+}
+
+} // namespace journal_detail
+
+// One state change; fixed size, so the journal can be indexed by record.
+struct journal_record {
+    std::uint32_t instance;
+    std::uint8_t event;
+    std::uint8_t from;
+    std::uint8_t to;
+    std::uint8_t reserved;
+    // Nanoseconds since the Unix epoch.
+    std::int64_t timestamp;
+    // Low 32 bits of the record's position in the journal, so a stale
+    // record that happens to check out is still rejected in the wrong place.
+    std::uint32_t sequence;
+    // CRC-32C of the fields above, so a record torn or zeroed by a crash
+    // while it was being written is recognized and dropped.
+    std::uint32_t check;
+
+    std::uint32_t checksum() const {
+        return journal_detail::crc32c(this, offsetof(journal_record, check));
+    }
+
+    bool valid_at(std::uint64_t position) const {
+        return sequence == static_cast<std::uint32_t>(position) && check == checksum();
+    }
+};
+static_assert(sizeof(journal_record) == 24 && offsetof(journal_record, check) == 20,
+              "journal_record must have no padding");
+
+struct journal_file_header {
+    static constexpr std::uint64_t expected_magic = 0x66736d2d6a726e6c; // "fsm-jrnl"
+
+    static constexpr std::uint64_t current_version = 2;
+
+    std::uint64_t magic;
+    std::uint64_t version;
+    // Position of the first record in the file, counting the records of
+    // the journals before it.
+    std::uint64_t first;
+};
+
+struct snapshot_header {
+    static constexpr std::uint64_t expected_magic = 0x66736d2d736e6170; // "fsm-snap"
+
+    std::uint64_t magic;
+    std::uint64_t instances;
+    // Number of journal records already reflected in the states.
+    std::uint64_t journal_position;
+    std::int64_t timestamp;
+};
+
+struct journal_options {
+    // Records buffered before record() commits on its own.
+    std::size_t group_size = 4096;
+    // fdatasync() after every group; without it a commit only survives a
+    // crash of the process, not of the machine.
+    bool sync = true;
+};
+
+namespace journal_detail {
+
+inline std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+[[noreturn]] inline void fail(const std::string& what) {
+    throw std::system_error{errno, std::generic_category(), what};
+}
+
+inline void write_all(int fd, const void* data, std::size_t size, const std::string& path) {
+    auto* bytes = static_cast<const char*>(data);
+    while(size != 0) {
+        const auto written = ::write(fd, bytes, size);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fail("write " + path);
+        }
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+// A whole file mapped read-only; empty if the file does not exist.
+class file_view {
+public:
+    explicit file_view(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            if(errno == ENOENT) {
+                return;
+            }
+            fail("open " + path);
+        }
+        struct stat st {};
+        if(fstat(fd, &st) != 0) {
+            close(fd);
+            fail("fstat " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if(size_ != 0) {
+            base_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(base_ == MAP_FAILED) {
+                close(fd);
+                fail("mmap " + path);
+            }
+            madvise(base_, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~file_view() {
+        if(size_ != 0) {
+            munmap(base_, size_);
+        }
+    }
+
+    file_view(const file_view&) = delete;
+    file_view& operator=(const file_view&) = delete;
+
+    const char* data() const { return static_cast<const char*>(base_); }
+    std::size_t size() const { return size_; }
+
+private:
+    void* base_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+inline journal_file_header read_header(const char* data, std::size_t size,
+                                       const std::string& path) {
+    journal_file_header header{};
+    if(size >= sizeof(header)) {
+        std::memcpy(&header, data, sizeof(header));
+    }
+    if(header.magic != journal_file_header::expected_magic ||
+       header.version != journal_file_header::current_version) {
+        throw std::runtime_error{path + " is not an fsm journal"};
+    }
+    return header;
+}
+
+// Makes a rename into path's directory durable.
+inline void sync_directory(const std::string& path) {
+    const auto slash = path.rfind('/');
+    const auto dir = slash == std::string::npos ? std::string{"."}
+                     : slash == 0               ? std::string{"/"}
+                                                : path.substr(0, slash);
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd < 0) {
+        fail("open " + dir);
+    }
+    const bool synced = fsync(fd) == 0;
+    const auto error = errno;
+    ::close(fd);
+    if(!synced) {
+        errno = error;
+        fail("fsync " + dir);
+    }
+}
+
+// Writes a journal holding nothing but its header to path + ".tmp",
+// flushes it and renames it over path.
+inline int start_file(const std::string& path, std::uint64_t first, bool sync) {
+    const auto tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fail("open " + tmp);
+    }
+    try {
+        const journal_file_header header{journal_file_header::expected_magic,
+                                         journal_file_header::current_version, first};
+        write_all(fd, &header, sizeof(header), tmp);
+        if(sync && fdatasync(fd) != 0) {
+            fail("fdatasync " + tmp);
+        }
+        if(std::rename(tmp.c_str(), path.c_str()) != 0) {
+            fail("rename " + tmp);
+        }
+        if(sync) {
+            sync_directory(path);
+        }
+    } catch(...) {
+        ::close(fd);
+        throw;
+    }
+    return fd;
+}
+
+// Number of whole, valid records at the start of a journal of `size`
+// bytes whose first record is at position `first`. Only the group being
+// written during a crash can be damaged, and nothing after the first bad
+// record is trusted.
+inline std::uint64_t valid_records(const char* data, std::size_t size, std::uint64_t first) {
+    if(size < sizeof(journal_file_header)) {
+        return 0;
+    }
+    const auto* records =
+        reinterpret_cast<const journal_record*>(data + sizeof(journal_file_header));
+    const auto whole = (size - sizeof(journal_file_header)) / sizeof(journal_record);
+    std::uint64_t count = 0;
+    while(count < whole && records[count].valid_at(first + count)) {
+        ++count;
+    }
+    return count;
+}
+
+} // namespace journal_detail
+
+class fsm_journal {
+public:
+    // Opens the journal for appending, creating it if needed. A torn tail
+    // left by a crash is cut off first.
+    explicit fsm_journal(const std::string& path, journal_options options = {})
+        : path_{path}, options_{options} {
+        std::uint64_t records = 0;
+        {
+            const journal_detail::file_view existing{path};
+            if(existing.size() == 0) {
+                fd_ = journal_detail::start_file(path, 0, options_.sync);
+            } else {
+                first_ = journal_detail::read_header(existing.data(), existing.size(), path).first;
+                records = journal_detail::valid_records(existing.data(), existing.size(), first_);
+            }
+        }
+        if(fd_ < 0) {
+            fd_ = ::open(path.c_str(), O_WRONLY);
+            if(fd_ < 0) {
+                journal_detail::fail("open " + path);
+            }
+            const auto end = static_cast<off_t>(sizeof(journal_file_header) +
+                                                records * sizeof(journal_record));
+            if(ftruncate(fd_, end) != 0 || lseek(fd_, end, SEEK_SET) < 0) {
+                ::close(fd_);
+                journal_detail::fail("truncate " + path);
+            }
+        }
+        committed_ = first_ + records;
+        pending_.reserve(options_.group_size);
+    }
+
+    // Commits and closes without reporting failures; call close() first
+    // to find out whether the last records reached the disk.
+    ~fsm_journal() {
+        if(fd_ >= 0) {
+            try {
+                commit();
+            } catch(const std::exception&) {
+            }
+            ::close(fd_);
+        }
+    }
+
+    fsm_journal(const fsm_journal&) = delete;
+    fsm_journal& operator=(const fsm_journal&) = delete;
+
+    // Records written so far, committed or not; a snapshot taken now
+    // reaches this far.
+    std::uint64_t position() const { return committed_ + pending_.size(); }
+    std::uint64_t committed() const { return committed_; }
+
+    // Matches the on_change hook of fsm_bank::apply() and broadcast().
+    template <typename Event, typename State>
+    void operator()(std::uint32_t instance, Event event, State from, State to) {
+        record(instance, event, from, to);
+    }
+
+    template <typename Event, typename State>
+    void record(std::uint32_t instance, Event event, State from, State to) {
+        journal_record r{instance,
+                         static_cast<std::uint8_t>(event),
+                         static_cast<std::uint8_t>(from),
+                         static_cast<std::uint8_t>(to),
+                         0,
+                         stamp_,
+                         static_cast<std::uint32_t>(position()),
+                         0};
+        r.check = r.checksum();
+        pending_.push_back(r);
+        if(pending_.size() >= options_.group_size) {
+            commit();
+        }
+    }
+
+    // Commits and closes the file, throwing if either fails. Nothing may be
+    // recorded afterwards.
+    void close() {
+        if(fd_ < 0) {
+            return;
+        }
+        commit();
+        if(::close(std::exchange(fd_, -1)) != 0) {
+            journal_detail::fail("close " + path_);
+        }
+    }
+
+    // Writes the buffered records as one group. Records carry the time
+    // their group was started, read once per group.
+    void commit() {
+        stamp_ = journal_detail::now_ns();
+        if(pending_.empty()) {
+            return;
+        }
+        journal_detail::write_all(fd_, pending_.data(), pending_.size() * sizeof(journal_record),
+                                  path_);
+        if(options_.sync && fdatasync(fd_) != 0) {
+            journal_detail::fail("fdatasync " + path_);
+        }
+        committed_ += pending_.size();
+        pending_.clear();
+    }
+
+    // Commits, then writes `states` to a new snapshot file and renames it
+    // over `path` (syncing its directory), so a crash leaves either the old
+    // snapshot or the new one.
+    // The journal is then replaced by an empty one starting at the
+    // snapshot's position; until that rename the old journal stays valid
+    // too.
+    void snapshot(const std::string& path, std::span<const std::uint8_t> states) {
+        commit();
+        const auto tmp = path + ".tmp";
+        const int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            journal_detail::fail("open " + tmp);
+        }
+        const auto size = sizeof(snapshot_header) + states.size();
+        void* base = MAP_FAILED;
+        if(ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if(base == MAP_FAILED) {
+            ::close(fd);
+            journal_detail::fail("map " + tmp);
+        }
+        const snapshot_header header{snapshot_header::expected_magic, states.size(), committed_,
+                                     journal_detail::now_ns()};
+        std::memcpy(base, &header, sizeof(header));
+        std::memcpy(static_cast<char*>(base) + sizeof(header), states.data(), states.size());
+        const bool synced = !options_.sync || msync(base, size, MS_SYNC) == 0;
+        munmap(base, size);
+        ::close(fd);
+        if(!synced) {
+            journal_detail::fail("msync " + tmp);
+        }
+        if(std::rename(tmp.c_str(), path.c_str()) != 0) {
+            journal_detail::fail("rename " + tmp);
+        }
+        if(options_.sync) {
+            journal_detail::sync_directory(path);
+        }
+        const int fresh = journal_detail::start_file(path_, committed_, options_.sync);
+        ::close(fd_);
+        fd_ = fresh;
+        first_ = committed_;
+    }
+
+private:
+    std::string path_;
+    journal_options options_;
+    int fd_ = -1;
+    std::uint64_t first_ = 0;
+    std::uint64_t committed_ = 0;
+    std::int64_t stamp_ = journal_detail::now_ns();
+    std::vector<journal_record> pending_;
+};
+
+struct recovery {
+    // Journal records covered by the snapshot; 0 without one.
+    std::uint64_t snapshot_position = 0;
+    // Journal records applied on top of it.
+    std::uint64_t replayed = 0;
+};
+
+// Rebuilds `states` from the snapshot at snapshot_path (if there is one)
+// and the journal after it (if there is one). Without a snapshot, states
+// must already hold the initial states.
+inline recovery recover(const std::string& snapshot_path, const std::string& journal_path,
+                        std::span<std::uint8_t> states) {
+    recovery result;
+    {
+        const journal_detail::file_view snapshot{snapshot_path};
+        if(snapshot.size() != 0) {
+            snapshot_header header{};
+            if(snapshot.size() >= sizeof(header)) {
+                std::memcpy(&header, snapshot.data(), sizeof(header));
+            }
+            if(header.magic != snapshot_header::expected_magic ||
+               snapshot.size() != sizeof(header) + header.instances) {
+                throw std::runtime_error{snapshot_path + " is not an fsm snapshot"};
+            }
+            if(header.instances != states.size()) {
+                throw std::runtime_error{snapshot_path + " holds a different number of instances"};
+            }
+            std::memcpy(states.data(), snapshot.data() + sizeof(header), states.size());
+            result.snapshot_position = header.journal_position;
+        }
+    }
+    const journal_detail::file_view journal{journal_path};
+    if(journal.size() == 0) {
+        return result;
+    }
+    const auto first = journal_detail::read_header(journal.data(), journal.size(), journal_path).first;
+    if(first > result.snapshot_position) {
+        throw std::runtime_error{journal_path + " starts after the snapshot"};
+    }
+    const auto count = journal_detail::valid_records(journal.data(), journal.size(), first);
+    const auto* records =
+        reinterpret_cast<const journal_record*>(journal.data() + sizeof(journal_file_header));
+    for(auto i = result.snapshot_position - first; i < count; ++i) {
+        const auto& r = records[i];
+        if(r.instance >= states.size()) {
+            throw std::runtime_error{journal_path + " names an instance out of range"};
+        }
+        states[r.instance] = r.to;
+        ++result.replayed;
+    }
+    return result;
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Many instances of one fsm<> machine driven from any number of threads.
+//
+// Instance i belongs to shard i % shards. A shard owns its machines and an
+// inbox that any thread may post to; whichever thread holds the shard runs
+// its events in inbox order, so the events for one instance are handled in
+// the order they were posted (per posting thread) and a machine is never
+// touched by two threads at once. Shards are run as detached tasks on a
+// ThreadPool and hand the worker back after max_batch events.
+//
+// A post that finds the inbox full runs the shard itself if nobody else
+// is, so posting from the pool's own workers cannot deadlock.
+
+struct runtime_options {
+    // 0 picks four shards per pool worker.
+    std::size_t shards = 0;
+    // Events each inbox holds, rounded up to a power of two.
+    std::size_t inbox_capacity = 1 << 14;
+    std::size_t max_batch = 4096;
+};
+
+template <typename Machine>
+class fsm_runtime {
+public:
+    using event_type = typename Machine::event_type;
+
+    fsm_runtime(thread_pool::ThreadPool& pool, std::size_t instances,
+                const Machine& prototype = Machine{}, runtime_options options = {})
+        : pool_{pool},
+          shard_count_{options.shards != 0 ? options.shards : 4 * pool.capacity()},
+          max_batch_{options.max_batch != 0 ? options.max_batch : 1},
+          shards_{std::make_unique<shard[]>(shard_count_)} {
+        std::size_t capacity = 1;
+        while(capacity < options.inbox_capacity) {
+            capacity <<= 1;
+        }
+        for(std::size_t s = 0; s < shard_count_; ++s) {
+            auto& sh = shards_[s];
+            sh.machines.assign(instances / shard_count_ + (s < instances % shard_count_), prototype);
+            sh.slots = std::make_unique<slot[]>(capacity);
+            sh.mask = capacity - 1;
+            for(std::size_t i = 0; i < capacity; ++i) {
+                sh.slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ~fsm_runtime() {
+        drain();
+        // Tasks for shards already run by a poster may still be queued.
+        while(in_flight_.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    fsm_runtime(const fsm_runtime&) = delete;
+    fsm_runtime& operator=(const fsm_runtime&) = delete;
+
+    std::size_t shards() const { return shard_count_; }
+
+    // Only safe while no events are pending, e.g. after drain().
+    Machine& machine(std::uint32_t instance) {
+        return shards_[instance % shard_count_].machines[instance / shard_count_];
+    }
+
+    // Thread safe. Blocks (running the shard if it can) while the inbox is
+    // full.
+    void post(std::uint32_t instance, event_type event) {
+        auto& sh = shards_[instance % shard_count_];
+        const auto local = static_cast<std::uint32_t>(instance / shard_count_);
+        while(!sh.try_push(local, event)) {
+            if(claim(sh, state_idle) || claim(sh, state_queued)) {
+                sh.consume(max_batch_);
+                release(sh);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        // Pairs with the fence in release(): either this sees the shard
+        // idle, or the thread that made it idle sees the event.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sh.state.load(std::memory_order_relaxed) == state_idle &&
+           claim(sh, state_idle, state_queued)) {
+            submit(sh);
+        }
+    }
+
+    // Waits until every event posted before the call has been handled. Must
+    // not be called from one of the pool's workers.
+    void drain() {
+        for(std::size_t s = 0; s < shard_count_; ++s) {
+            auto& sh = shards_[s];
+            const auto posted = sh.tail.load(std::memory_order_acquire);
+            auto done = sh.done.load(std::memory_order_acquire);
+            while(done < posted) {
+                sh.done.wait(done, std::memory_order_acquire);
+                done = sh.done.load(std::memory_order_acquire);
+            }
+        }
+    }
+
+private:
+    static constexpr std::uint8_t state_idle = 0;
+    // A task to run the shard has been submitted and not started yet.
+    static constexpr std::uint8_t state_queued = 1;
+    static constexpr std::uint8_t state_running = 2;
+
+    struct slot {
+        std::atomic<std::uint64_t> sequence;
+        std::uint32_t local;
+        event_type event;
+    };
+
+    // The inbox is a bounded multi-producer ring in which each slot's
+    // sequence says whose turn it is: a producer may fill slot p when it
+    // reads p, the consumer may take it when it reads p + 1.
+    struct alignas(64) shard {
+        std::vector<Machine> machines;
+        std::unique_ptr<slot[]> slots;
+        std::uint64_t mask = 0;
+        // Only touched by the thread running the shard.
+        std::uint64_t head = 0;
+
+        alignas(64) std::atomic<std::uint64_t> tail{0};
+        alignas(64) std::atomic<std::uint8_t> state{state_idle};
+        std::atomic<std::uint64_t> done{0};
+
+        bool try_push(std::uint32_t local, event_type event) {
+            auto pos = tail.load(std::memory_order_relaxed);
+            for(;;) {
+                auto& s = slots[pos & mask];
+                const auto sequence = s.sequence.load(std::memory_order_acquire);
+                if(sequence == pos) {
+                    if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        s.local = local;
+                        s.event = event;
+                        s.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(sequence < pos) {
+                    return false;
+                } else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool has_event_at(std::uint64_t pos) const {
+            return slots[pos & mask].sequence.load(std::memory_order_acquire) == pos + 1;
+        }
+
+        // Returns how many events were handled, at most `limit`.
+        std::size_t consume(std::size_t limit) {
+            std::size_t handled = 0;
+            while(handled < limit) {
+                auto& s = slots[head & mask];
+                if(s.sequence.load(std::memory_order_acquire) != head + 1) {
+                    break;
+                }
+                machines[s.local].handle_event(s.event);
+                s.sequence.store(head + mask + 1, std::memory_order_release);
+                ++head;
+                ++handled;
+            }
+            if(handled != 0) {
+                done.store(head, std::memory_order_release);
+                done.notify_all();
+            }
+            return handled;
+        }
+    };
+
+    static bool claim(shard& sh, std::uint8_t from, std::uint8_t to = state_running) {
+        return sh.state.compare_exchange_strong(from, to, std::memory_order_acquire,
+                                                std::memory_order_relaxed);
+    }
+
+    // Once idle the shard may be claimed at once, so look for events from
+    // where this thread left off rather than at the shared head.
+    void release(shard& sh) {
+        const auto head = sh.head;
+        sh.state.store(state_idle, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sh.has_event_at(head) && claim(sh, state_idle, state_queued)) {
+            submit(sh);
+        }
+    }
+
+    void submit(shard& sh) {
+        in_flight_.fetch_add(1, std::memory_order_relaxed);
+        pool_.submit_detached([this, &sh] { run(sh); });
+    }
+
+    // A task finding the shard no longer queued was overtaken by a poster
+    // and has nothing to do.
+    void run(shard& sh) {
+        if(claim(sh, state_queued)) {
+            if(sh.consume(max_batch_) == max_batch_) {
+                sh.state.store(state_queued, std::memory_order_release);
+                submit(sh);
+            } else {
+                release(sh);
+            }
+        }
+        in_flight_.fetch_sub(1, std::memory_order_release);
+    }
+
+    thread_pool::ThreadPool& pool_;
+    std::size_t shard_count_;
+    std::size_t max_batch_;
+    std::unique_ptr<shard[]> shards_;
+    std::atomic<std::size_t> in_flight_{0};
+};
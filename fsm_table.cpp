@@ -0,0 +1,25 @@
+#include "ble_fsm.h"
+
+#include <cstdio>
+
+int main() {
+    ble_fsm my_ble_fsm;
+    const auto print_current_state = [&]() {
+        printf("Current State: %s\n", state_to_string(my_ble_fsm.get_state()));
+    };
+    print_current_state();
+    my_ble_fsm.handle_event(ble_event::ble_button_pressed);
+    print_current_state();
+    my_ble_fsm.handle_event(ble_event::connection_request);
+    print_current_state();
+    my_ble_fsm.handle_event(ble_event::ble_button_pressed);
+    print_current_state();
+    // The same machine with events known at compile time.
+    my_ble_fsm.handle_event<ble_event::ble_button_pressed>();
+    print_current_state();
+    my_ble_fsm.handle_event<ble_event::timer_expired>();
+    print_current_state();
+    while(true)
+    {
+    }
+}
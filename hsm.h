@@ -0,0 +1,259 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+// Compile-time hierarchical state machine over event tag types.
+//
+// States are types with static members, all optional:
+//     using parent = session;             // enclosing state
+//     using initial = advertising;        // child entered by default
+//     static void entry(Context&);
+//     static void exit(Context&);
+//     static auto on(const Event&, Context&);
+// on() returns void (handled, stay), transition_to<Target>, defer_event,
+// not_handled (let the parent try), or a std::variant of those when the
+// choice is made at run time. A state without on() for an event passes it
+// to its parent.
+//
+// Only leaf states are ever current. The current leaf is a std::variant of
+// empty types, so dispatch is a std::visit jump to code in which the whole
+// handler chain, the exits and the entries are direct calls. Deferred
+// events wait in a fixed inline ring and are offered again after every
+// transition. Nothing allocates.
+
+template <typename Target>
+struct transition_to {};
+struct defer_event {};
+struct not_handled {};
+
+template <typename... Leaves>
+struct states {};
+template <typename... Events>
+struct events {};
+
+enum class hsm_result {
+    handled,
+    transitioned,
+    deferred,
+    // The event had to be deferred but the deferral ring was full.
+    dropped,
+    unhandled
+};
+
+namespace hsm_detail {
+
+struct root {};
+
+template <typename S>
+struct parent_of {
+    using type = root;
+};
+template <typename S>
+    requires requires { typename S::parent; }
+struct parent_of<S> {
+    using type = typename S::parent;
+};
+template <typename S>
+using parent_t = typename parent_of<S>::type;
+
+template <typename A, typename S>
+constexpr bool is_proper_ancestor() {
+    if constexpr (std::is_same_v<S, root>) {
+        return false;
+    } else if constexpr (std::is_same_v<parent_t<S>, A>) {
+        return true;
+    } else {
+        return is_proper_ancestor<A, parent_t<S>>();
+    }
+}
+
+// The innermost state enclosing both A and B; root if there is none.
+template <typename A, typename B>
+struct common_parent {
+    using candidate = parent_t<A>;
+    using type = std::conditional_t<
+        std::is_same_v<candidate, root> || is_proper_ancestor<candidate, B>(), candidate,
+        typename common_parent<candidate, B>::type>;
+};
+template <typename B>
+struct common_parent<root, B> {
+    using type = root;
+};
+
+template <typename S>
+struct leaf_of {
+    using type = S;
+};
+template <typename S>
+    requires requires { typename S::initial; }
+struct leaf_of<S> {
+    using type = typename leaf_of<typename S::initial>::type;
+};
+
+} // namespace hsm_detail
+
+template <typename Context, typename Initial, typename States, typename Events,
+          std::size_t DeferCapacity = 4>
+class hsm;
+
+template <typename Context, typename Initial, typename... Leaves, typename... Events,
+          std::size_t DeferCapacity>
+class hsm<Context, Initial, states<Leaves...>, events<Events...>, DeferCapacity> {
+public:
+    template <typename... Args>
+    explicit hsm(Args&&... args) : context_(std::forward<Args>(args)...) {
+        enter<hsm_detail::root, Initial>();
+    }
+
+    Context& context() { return context_; }
+    const Context& context() const { return context_; }
+
+    // True if S is the current leaf or one of its parents.
+    template <typename S>
+    bool is_in() const {
+        return std::visit([](auto leaf) {
+            using L = decltype(leaf);
+            return std::is_same_v<L, S> || hsm_detail::is_proper_ancestor<S, L>();
+        }, current_);
+    }
+
+    std::size_t deferred() const { return deferred_count_; }
+
+    template <typename E>
+    hsm_result dispatch(const E& event) {
+        const auto result = dispatch_once(event);
+        if(result == hsm_result::transitioned) {
+            replay_deferred();
+        }
+        return result;
+    }
+
+private:
+    template <typename E>
+    hsm_result dispatch_once(const E& event) {
+        return std::visit([&](auto leaf) {
+            return handle<decltype(leaf), decltype(leaf)>(event);
+        }, current_);
+    }
+
+    // Offers S's handler for the event, then its parents'.
+    template <typename Leaf, typename S, typename E>
+    hsm_result handle(const E& event) {
+        if constexpr (std::is_same_v<S, hsm_detail::root>) {
+            return hsm_result::unhandled;
+        } else if constexpr (requires { S::on(event, context_); }) {
+            if constexpr (std::is_void_v<decltype(S::on(event, context_))>) {
+                S::on(event, context_);
+                return hsm_result::handled;
+            } else {
+                return outcome<Leaf, S>(S::on(event, context_), event);
+            }
+        } else {
+            return handle<Leaf, hsm_detail::parent_t<S>>(event);
+        }
+    }
+
+    template <typename Leaf, typename S, typename E, typename Target>
+    hsm_result outcome(transition_to<Target>, const E&) {
+        transit<Leaf, S, Target>();
+        return hsm_result::transitioned;
+    }
+
+    template <typename Leaf, typename S, typename E>
+    hsm_result outcome(defer_event, const E& event) {
+        static_assert((std::is_same_v<E, Events> || ...),
+                      "Only events listed in events<...> can be deferred");
+        if(deferred_count_ == DeferCapacity) {
+            return hsm_result::dropped;
+        }
+        deferred_[(deferred_head_ + deferred_count_++) % DeferCapacity] = event;
+        return hsm_result::deferred;
+    }
+
+    template <typename Leaf, typename S, typename E>
+    hsm_result outcome(not_handled, const E& event) {
+        return handle<Leaf, hsm_detail::parent_t<S>>(event);
+    }
+
+    template <typename Leaf, typename S, typename E, typename... Rs>
+    hsm_result outcome(const std::variant<Rs...>& result, const E& event) {
+        return std::visit([&](auto r) { return outcome<Leaf, S>(r, event); }, result);
+    }
+
+    // Exits from the current leaf up to the state enclosing both the
+    // handling state and the target, then enters down to the target and
+    // through its initial children to a leaf.
+    template <typename Leaf, typename Source, typename Target>
+    void transit() {
+        using scope = typename hsm_detail::common_parent<Source, Target>::type;
+        exit_up_to<Leaf, scope>();
+        enter<scope, Target>();
+    }
+
+    template <typename S, typename Stop>
+    void exit_up_to() {
+        if constexpr (!std::is_same_v<S, Stop>) {
+            if constexpr (requires { S::exit(context_); }) {
+                S::exit(context_);
+            }
+            exit_up_to<hsm_detail::parent_t<S>, Stop>();
+        }
+    }
+
+    template <typename Stop, typename S>
+    void enter_down_to() {
+        if constexpr (!std::is_same_v<S, Stop>) {
+            enter_down_to<Stop, hsm_detail::parent_t<S>>();
+            if constexpr (requires { S::entry(context_); }) {
+                S::entry(context_);
+            }
+        }
+    }
+
+    template <typename Stop, typename Target>
+    void enter() {
+        using leaf = typename hsm_detail::leaf_of<Target>::type;
+        static_assert((std::is_same_v<leaf, Leaves> || ...),
+                      "Every state a transition can end in must be listed in states<...>");
+        enter_down_to<Stop, leaf>();
+        current_.template emplace<leaf>();
+    }
+
+    // Offers each deferred event to the new state once; repeats while that
+    // keeps causing transitions. Events deferred again keep their order.
+    void replay_deferred() {
+        if(replaying_) {
+            return;
+        }
+        replaying_ = true;
+        bool transitioned = true;
+        while(transitioned && deferred_count_ != 0) {
+            transitioned = false;
+            for(auto pending = deferred_count_; pending != 0; --pending) {
+                const auto event = deferred_[deferred_head_];
+                deferred_head_ = (deferred_head_ + 1) % DeferCapacity;
+                --deferred_count_;
+                const auto result = std::visit([&](const auto& e) {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(e)>, std::monostate>) {
+                        return hsm_result::unhandled;
+                    } else {
+                        return dispatch_once(e);
+                    }
+                }, event);
+                transitioned |= result == hsm_result::transitioned;
+            }
+        }
+        replaying_ = false;
+    }
+
+    Context context_;
+    std::variant<Leaves...> current_;
+    std::array<std::variant<std::monostate, Events...>, DeferCapacity> deferred_{};
+    std::size_t deferred_head_ = 0;
+    std::size_t deferred_count_ = 0;
+    bool replaying_ = false;
+};
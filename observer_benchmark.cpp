@@ -0,0 +1,517 @@
+// Producer latency and delivery throughput of the observer variants.
+//
+// Build: g++ -std=c++20 -O2 -pthread observer_benchmark.cpp
+// Run:   ./a.out [delivery|async|hybrid|block|shm]
+//        (no argument runs everything)
+//
+// 'delivery' paces one producer at 10M notify() calls per second and
+// compares synchronous delivery with each asynchronous backpressure policy,
+// once with a subscriber that keeps up and once with one that does not.
+// 'async' has several threads notify() one asynchronous subscriber at once
+// and has subscribers unregistered from their own delivery thread, with
+// the ring full, and from another subscriber's update(); it exits non-zero
+// if a value is lost or delivered twice.
+// 'hybrid' measures the cost of one notify() to three subscribers through
+// the virtual publisher, the compile-time bus and the hybrid publisher.
+// 'block' feeds sensor blocks to the built-in block subscribers once per
+// sample and once per block; it exits non-zero if the two disagree.
+// 'shm' forks a subscriber process and publishes to it through a
+// shared-memory ring, from one thread and then from several; it exits
+// non-zero if the values received and lost do not add up.
+#include "observer_hybrid.h"
+#include "observer_rt.h"
+#include "observer_shm.h"
+#include "observer_simd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr std::uint64_t events_per_second = 10'000'000;
+constexpr std::uint64_t events_per_run = 2'000'000;
+// Timing every call would cost as much as the call itself.
+constexpr std::uint64_t latency_sample_every = 64;
+
+class fast_counter : public subscriber {
+public:
+    void update(float) override { count_.fetch_add(1, std::memory_order_relaxed); }
+    void update_batch(std::span<const float> values) override {
+        count_.fetch_add(values.size(), std::memory_order_relaxed);
+    }
+    std::uint64_t count() const { return count_.load(); }
+private:
+    std::atomic<std::uint64_t> count_{0};
+};
+
+// Spends a few hundred nanoseconds on every value.
+class slow_filter : public subscriber {
+public:
+    void update(float value) override {
+        for(int i = 0; i < 64; ++i) {
+            state_ = std::sqrt(state_ * 0.5f + value);
+        }
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::uint64_t count() const { return count_.load(); }
+private:
+    volatile float state_ = 1.0f;
+    std::atomic<std::uint64_t> count_{0};
+};
+
+struct run_result {
+    double offered_per_second;
+    double delivered_per_second;
+    std::uint64_t delivered;
+    std::int64_t p50_ns;
+    std::int64_t p99_ns;
+    std::int64_t max_ns;
+};
+
+std::int64_t nanos(bench_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+// With no options the subscriber is called synchronously.
+template <typename Sub>
+run_result run(std::optional<delivery_options> options) {
+    Sub sub;
+    publisher pub;
+    if(options) {
+        pub.register_async(&sub, *options);
+    } else {
+        pub.register_sub(&sub);
+    }
+    std::vector<std::int64_t> samples;
+    samples.reserve(events_per_run / latency_sample_every + 1);
+    const auto interval = std::chrono::nanoseconds{1'000'000'000 / events_per_second};
+    const auto start = bench_clock::now();
+    auto due = start;
+    for(std::uint64_t i = 0; i < events_per_run; ++i) {
+        // Fall behind rather than burst: a late producer does not catch up.
+        while(bench_clock::now() < due) {
+        }
+        due += interval;
+        const auto value = static_cast<float>(i & 1023);
+        if(i % latency_sample_every == 0) {
+            const auto before = bench_clock::now();
+            pub.notify(value);
+            samples.push_back(nanos(bench_clock::now() - before));
+        } else {
+            pub.notify(value);
+        }
+    }
+    const auto produced = bench_clock::now();
+    // Waits for an asynchronous subscriber to take what is still queued.
+    pub.unregister(&sub);
+    const auto delivered = bench_clock::now();
+
+    std::sort(samples.begin(), samples.end());
+    const auto percentile = [&](double p) {
+        return samples[static_cast<std::size_t>(p * (samples.size() - 1))];
+    };
+    const auto seconds = [&](bench_clock::time_point end) {
+        return std::chrono::duration<double>(end - start).count();
+    };
+    return {events_per_run / seconds(produced),
+            sub.count() / seconds(delivered),
+            sub.count(),
+            percentile(0.5),
+            percentile(0.99),
+            samples.back()};
+}
+
+template <typename Sub>
+void report(const char* subscriber_name, const char* mode,
+            std::optional<delivery_options> options) {
+    const auto r = run<Sub>(options);
+    printf("%-6s %-16s %7.2f M/s %7.2f M/s %9llu %9llu %6lld %6lld %8lld\n",
+           subscriber_name, mode, r.offered_per_second / 1e6,
+           r.delivered_per_second / 1e6,
+           static_cast<unsigned long long>(r.delivered),
+           static_cast<unsigned long long>(events_per_run - r.delivered),
+           static_cast<long long>(r.p50_ns), static_cast<long long>(r.p99_ns),
+           static_cast<long long>(r.max_ns));
+}
+
+template <typename Sub>
+void bench_subscriber(const char* subscriber_name) {
+    report<Sub>(subscriber_name, "sync", std::nullopt);
+    report<Sub>(subscriber_name, "drop_oldest",
+                delivery_options{.policy = backpressure::drop_oldest});
+    report<Sub>(subscriber_name, "block",
+                delivery_options{.policy = backpressure::block});
+    report<Sub>(subscriber_name, "coalesce_latest",
+                delivery_options{.policy = backpressure::coalesce_latest});
+}
+
+void bench_delivery() {
+    printf("delivery: %llu events paced at %.0fM/s, notify() latency sampled "
+           "every %llu calls\n",
+           static_cast<unsigned long long>(events_per_run),
+           events_per_second / 1e6,
+           static_cast<unsigned long long>(latency_sample_every));
+    printf("%-6s %-16s %11s %11s %9s %9s %6s %6s %8s\n", "sub", "mode",
+           "produced", "delivered", "received", "dropped", "p50ns", "p99ns",
+           "maxns");
+    bench_subscriber<fast_counter>("fast");
+    bench_subscriber<slow_filter>("slow");
+}
+
+// The same work behind each kind of dispatch.
+template <int Id>
+struct static_sum {
+    using handles = event_list<float>;
+    static inline float total = 0.0f;
+    static void update(float value) { total += value * Id; }
+};
+
+template <int Id>
+class virtual_sum : public subscriber {
+public:
+    void update(float value) override { total += value * Id; }
+    float total = 0.0f;
+};
+
+template <int Id>
+class plugin_sum final {
+public:
+    void update(float value) { total += value * Id; }
+    float total = 0.0f;
+};
+
+constexpr std::uint64_t hybrid_notifies = 50'000'000;
+
+template <typename Notify>
+void time_notify(const char* name, Notify&& notify) {
+    const auto start = bench_clock::now();
+    for(std::uint64_t i = 0; i < hybrid_notifies; ++i) {
+        notify(static_cast<float>(i & 7));
+    }
+    const auto elapsed = bench_clock::now() - start;
+    printf("%-28s %6.2f ns/notify\n", name,
+           static_cast<double>(nanos(elapsed)) / hybrid_notifies);
+}
+
+void bench_hybrid() {
+    printf("hybrid: %llu notify() calls to three subscribers\n",
+           static_cast<unsigned long long>(hybrid_notifies));
+
+    virtual_sum<1> v1;
+    virtual_sum<2> v2;
+    virtual_sum<3> v3;
+    publisher dynamic;
+    dynamic.register_sub(&v1);
+    dynamic.register_sub(&v2);
+    dynamic.register_sub(&v3);
+    time_notify("virtual (observer_rt)", [&](float v) { dynamic.notify(v); });
+
+    using all_static = event_bus<static_sum<1>, static_sum<2>, static_sum<3>>;
+    time_notify("static (event_bus)", [](float v) { all_static::notify(v); });
+
+    plugin_sum<3> p3;
+    hybrid_publisher<float, static_sum<1>, static_sum<2>> two_plus_one;
+    two_plus_one.attach(p3);
+    time_notify("hybrid, 2 static + 1 plugin",
+                [&](float v) { two_plus_one.notify(v); });
+
+    plugin_sum<1> p1;
+    plugin_sum<2> p2;
+    hybrid_publisher<float> plugins_only;
+    plugins_only.attach(p1);
+    plugins_only.attach(p2);
+    plugins_only.attach(p3);
+    time_notify("hybrid, 3 plugins", [&](float v) { plugins_only.notify(v); });
+
+    // Keeps the sums observable so none of the loops can be dropped.
+    printf("checksum %.0f\n",
+           static_cast<double>(v1.total + v2.total + v3.total + p1.total +
+                               p2.total + p3.total + static_sum<1>::total +
+                               static_sum<2>::total + static_sum<3>::total));
+}
+
+constexpr std::size_t block_samples = 4096;
+constexpr std::size_t block_count = 2000;
+
+struct block_pipeline {
+    running_stats stats;
+    threshold_alarm alarm{0.95f};
+    fast_counter decimated;
+    decimator decimate{16, &decimated};
+    publisher pub;
+
+    block_pipeline() {
+        pub.register_sub(&stats);
+        pub.register_sub(&alarm);
+        pub.register_sub(&decimate);
+    }
+};
+
+bool bench_block() {
+    printf("block: %zu blocks of %zu samples to stats, alarm and decimator "
+           "(%s)\n",
+           block_count, block_samples,
+#ifdef OBSERVER_SIMD
+           "simd"
+#else
+           "scalar"
+#endif
+    );
+    std::vector<float> samples(block_samples);
+    std::uint32_t seed = 1;
+    for(auto& sample: samples) {
+        seed = seed * 1664525u + 1013904223u;
+        sample = static_cast<float>(seed >> 8) / (1u << 24);
+    }
+
+    block_pipeline per_sample;
+    auto start = bench_clock::now();
+    for(std::size_t b = 0; b < block_count; ++b) {
+        for(auto sample: samples) {
+            per_sample.pub.notify(sample);
+        }
+    }
+    const auto sample_ns = nanos(bench_clock::now() - start);
+
+    block_pipeline per_block;
+    start = bench_clock::now();
+    for(std::size_t b = 0; b < block_count; ++b) {
+        per_block.pub.notify_block(samples.data(), samples.size());
+    }
+    const auto block_ns = nanos(bench_clock::now() - start);
+
+    const double total = static_cast<double>(block_samples * block_count);
+    printf("%-16s %6.2f ns/sample\n", "notify()", sample_ns / total);
+    printf("%-16s %6.2f ns/sample (%.1fx)\n", "notify_block()", block_ns / total,
+           static_cast<double>(sample_ns) / block_ns);
+
+    const auto& a = per_sample;
+    const auto& b = per_block;
+    const bool same = a.stats.count() == b.stats.count() &&
+                      a.stats.min() == b.stats.min() &&
+                      a.stats.max() == b.stats.max() &&
+                      std::abs(a.stats.mean() - b.stats.mean()) < 1e-3 &&
+                      a.alarm.above() == b.alarm.above() &&
+                      a.decimated.count() == b.decimated.count();
+    if(!same) {
+        printf("FAIL: per-sample and per-block results differ\n");
+    }
+    return same;
+}
+
+constexpr std::uint64_t async_producers = 4;
+constexpr std::uint64_t async_events = 1'000'000;
+
+// Unregisters itself from the first update_batch() it gets, slowly enough
+// for the producer to fill the ring and wait for room.
+class one_shot : public subscriber {
+public:
+    explicit one_shot(publisher& pub) : pub_{pub} {}
+    void update(float) override {}
+    void update_batch(std::span<const float>) override {
+        batches_.fetch_add(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pub_.unregister(this);
+    }
+    std::uint64_t batches() const { return batches_.load(); }
+private:
+    publisher& pub_;
+    std::atomic<std::uint64_t> batches_{0};
+};
+
+// Unregisters another subscriber from the first update() it gets, while
+// the notify() that called it still has that subscriber to go.
+class unsubscriber : public subscriber {
+public:
+    unsubscriber(publisher& pub, subscriber* victim) : pub_{pub}, victim_{victim} {}
+    void update(float) override {
+        if(victim_) {
+            pub_.unregister(std::exchange(victim_, nullptr));
+        }
+    }
+private:
+    publisher& pub_;
+    subscriber* victim_;
+};
+
+bool bench_async() {
+    printf("async: %llu threads notify() one subscriber, %llu values each\n",
+           static_cast<unsigned long long>(async_producers),
+           static_cast<unsigned long long>(async_events));
+    fast_counter counter;
+    double seconds;
+    {
+        publisher pub;
+        pub.register_async(&counter, {1024, backpressure::block, 256});
+        const auto start = bench_clock::now();
+        std::vector<std::thread> producers;
+        for(std::uint64_t t = 0; t < async_producers; ++t) {
+            producers.emplace_back([&] {
+                for(std::uint64_t i = 0; i < async_events; ++i) {
+                    pub.notify(static_cast<float>(i));
+                }
+            });
+        }
+        for(auto& producer: producers) {
+            producer.join();
+        }
+        pub.unregister(&counter);
+        seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+    printf("%-16s %7.2f M/s delivered\n", "block",
+           counter.count() / seconds / 1e6);
+    bool ok = counter.count() == async_producers * async_events;
+
+    // Outlives the publisher, which may deliver to it until it is destroyed.
+    fast_counter victim;
+    publisher pub;
+    one_shot once{pub};
+    pub.register_async(&once, {4, backpressure::block, 1});
+    for(int i = 0; i < 1000; ++i) {
+        pub.notify(1.0f);
+    }
+    // Frees the channel left behind once the subscriber is gone.
+    fast_counter next;
+    pub.register_async(&next);
+    pub.notify(1.0f);
+    pub.unregister(&next);
+    ok = ok && once.batches() == 1 && next.count() == 1;
+
+    unsubscriber remover{pub, &victim};
+    pub.register_sub(&remover);
+    pub.register_async(&victim);
+    pub.notify(1.0f);
+    pub.notify(1.0f);
+    pub.unregister(&remover);
+    ok = ok && victim.count() == 1;
+    if(!ok) {
+        printf("FAIL: values lost or delivered after unregister\n");
+    }
+    return ok;
+}
+
+constexpr std::uint64_t shm_events = 20'000'000;
+constexpr std::size_t shm_block = 256;
+constexpr std::uint64_t shm_producers = 4;
+
+bool bench_shm() {
+    const std::string name = "/observer_bench_" + std::to_string(getpid());
+    printf("shm: %llu values to a subscriber process, one notify() per value, "
+           "one notify_block() per %zu, then one notify() per value from %llu "
+           "threads\n",
+           static_cast<unsigned long long>(shm_events), shm_block,
+           static_cast<unsigned long long>(shm_producers));
+    for(const char* mode: {"single", "block", "threads"}) {
+        auto writer = std::make_unique<shm_writer>(name);
+        fflush(stdout);
+        const pid_t child = fork();
+        if(child < 0) {
+            perror("fork");
+            return false;
+        }
+        if(child == 0) {
+            fast_counter received;
+            shm_reader reader{name};
+            const auto start = bench_clock::now();
+            while(!reader.finished()) {
+                if(reader.poll(received) == 0) {
+                    std::this_thread::yield();
+                }
+            }
+            const auto seconds =
+                std::chrono::duration<double>(bench_clock::now() - start).count();
+            printf("  subscriber: received %llu (%llu overwritten while read), "
+                   "lost %llu, %.2f M/s\n",
+                   static_cast<unsigned long long>(received.count()),
+                   static_cast<unsigned long long>(reader.overwritten()),
+                   static_cast<unsigned long long>(reader.lost()),
+                   received.count() / seconds / 1e6);
+            fflush(stdout);
+            _exit(received.count() + reader.lost() == shm_events ? 0 : 1);
+        }
+        while(writer->readers() == 0) {
+            std::this_thread::yield();
+        }
+        publisher pub;
+        pub.register_sub(writer.get());
+        std::vector<float> block(shm_block);
+        const auto start = bench_clock::now();
+        if(0 == strcmp(mode, "threads")) {
+            std::vector<std::thread> producers;
+            for(std::uint64_t t = 0; t < shm_producers; ++t) {
+                producers.emplace_back([&] {
+                    for(std::uint64_t i = 0; i < shm_events / shm_producers; ++i) {
+                        pub.notify(static_cast<float>(i & 1023));
+                    }
+                });
+            }
+            for(auto& producer: producers) {
+                producer.join();
+            }
+        } else {
+            for(std::uint64_t i = 0; i < shm_events;) {
+                if(0 == strcmp(mode, "block")) {
+                    for(auto& value: block) {
+                        value = static_cast<float>(i++ & 1023);
+                    }
+                    pub.notify_block(block.data(), block.size());
+                } else {
+                    pub.notify(static_cast<float>(i++ & 1023));
+                }
+            }
+        }
+        const auto elapsed = nanos(bench_clock::now() - start);
+        printf("%-7s publisher: %.2f ns/value\n", mode,
+               static_cast<double>(elapsed) / shm_events);
+        fflush(stdout);
+        pub.unregister(writer.get());
+        writer.reset();
+        int status = 0;
+        waitpid(child, &status, 0);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("FAIL: received and lost values do not add up\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto selected = [&](const char* section) {
+        return argc < 2 || 0 == strcmp(argv[1], section);
+    };
+    if(selected("delivery")) {
+        bench_delivery();
+    }
+    if(selected("async") && !bench_async()) {
+        return 1;
+    }
+    if(selected("hybrid")) {
+        bench_hybrid();
+    }
+    if(selected("block") && !bench_block()) {
+        return 1;
+    }
+    if(selected("shm") && !bench_shm()) {
+        return 1;
+    }
+    return 0;
+}
@@ -1,60 +1,62 @@
+#include "observer_ct.h"
+
 #include <cstdint>
 #include <cstdio>
-#include <functional>
-#include <vector>
+
+struct temperature_reading {
+    std::uint32_t sensor_id;
+    float celsius;
+};
+
+struct gps_fix {
+    double latitude;
+    double longitude;
+    float hdop;
+};
 
 struct display {
+    using handles = event_list<float, temperature_reading, gps_fix>;
     static void update(float temp) {
         printf("Displaying temperature %.2f \r\n", temp);
     }
+    static void update(const temperature_reading& reading) {
+        printf("Displaying sensor %u: %.2f \r\n", reading.sensor_id, reading.celsius);
+    }
+    static void update(const gps_fix& fix) {
+        printf("Displaying position %.5f, %.5f \r\n", fix.latitude, fix.longitude);
+    }
 };
 
 struct data_sender {
+    using handles = event_list<float, gps_fix>;
     static void update(float temp) {
         printf("Sending temperature %.2f \r\n", temp);
     }
+    static void update(const gps_fix& fix) {
+        printf("Sending position %.5f, %.5f (hdop %.1f) \r\n",
+               fix.latitude, fix.longitude, fix.hdop);
+    }
 };
 
 struct logger {
+    using handles = event_list<float, temperature_reading>;
     static void update(float temp) {
         printf("Logging temperature %.2f \r\n", temp);
     }
-};
-
-template<typename T>
-concept Updatable = requires (T, float f) {
-    { T::update(f) } -> std::same_as<void>; 
-};
-
-template<typename T>
-concept Notifiable = requires (T, float f) {
-    { T::notify(f) } -> std::same_as<void>; 
-};
-
-template <typename... Subs>
-struct publisher {
-    static void notify(float temp) {
-        (call_update_or_notify<Subs>(temp), ...);
-    }
-private:
-    template<typename T>
-    static void call_update_or_notify(float temp) {
-        if constexpr (Updatable<T>) {
-            T::update(temp);
-        } else if constexpr (Notifiable<T>) {
-            T::notify(temp);
-        }
-        else {
-            static_assert(false, "Type is not Updatable or Notifiable");
-        }
+    static void update(const temperature_reading& reading) {
+        printf("Logging sensor %u: %.2f \r\n", reading.sensor_id, reading.celsius);
     }
 };
 
 int main() {
-    using temp_publisher = publisher<display, data_sender>;
-    temp_publisher::notify(23.47);
-    using temp_publisher_new = publisher<temp_publisher, logger>;
-    temp_publisher_new::notify(42.42);
+    using temp_publisher = event_bus<display, data_sender>;
+    temp_publisher::notify(23.47f);
+    using temp_publisher_new = event_bus<temp_publisher, logger>;
+    temp_publisher_new::notify(42.42f);
+
+    // Only the subscribers that list an event type see it.
+    temp_publisher_new::notify(temperature_reading{7, 21.5f});
+    temp_publisher_new::notify(gps_fix{52.52001, 13.40495, 0.9f});
     while(true)
     {
     }
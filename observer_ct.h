@@ -0,0 +1,57 @@
+#pragma once
+
+#include <concepts>
+#include <type_traits>
+
+// The event types a subscriber handles, declared as
+//     using handles = event_list<temperature, gps_fix>;
+template <typename... Events>
+struct event_list {
+    template <typename E>
+    static constexpr bool contains = (std::is_same_v<E, Events> || ...);
+};
+
+template <typename Sub, typename E>
+concept subscribes_to = Sub::handles::template contains<E>;
+
+// Scalars may be taken by value; anything else needs an update(const E&)
+// overload, so publishing a record never copies it.
+template <typename Sub, typename E>
+concept Updatable =
+    (std::is_scalar_v<E> &&
+     requires (const E& e) { { Sub::update(e) } -> std::same_as<void>; }) ||
+    requires { static_cast<void (*)(const E&)>(&Sub::update); };
+
+// Every call is resolved at compile time: notify<E>() expands to a direct
+// call to update() on each subscriber whose handles list names E, and to
+// nothing for the others. A bus handles the union of its subscribers'
+// events, so it can itself subscribe to another bus.
+template <typename... Subs>
+struct event_bus {
+    struct handles {
+        template <typename E>
+        static constexpr bool contains = (subscribes_to<Subs, E> || ...);
+    };
+
+    template <typename E>
+    static void notify(const E& event) {
+        static_assert(handles::template contains<E>,
+                      "No subscriber handles this event type");
+        (deliver<Subs>(event), ...);
+    }
+
+    template <typename E>
+    static void update(const E& event) {
+        notify(event);
+    }
+
+private:
+    template <typename Sub, typename E>
+    static void deliver(const E& event) {
+        if constexpr (subscribes_to<Sub, E>) {
+            static_assert(Updatable<Sub, E>,
+                          "Subscriber lists the event but has no update(const E&)");
+            Sub::update(event);
+        }
+    }
+};
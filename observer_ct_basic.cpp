@@ -22,8 +22,11 @@ struct logger {
 
 template <typename... Subs>
 struct publisher {
-    static void notify(float temp) {
-        (Subs::update(temp), ...);
+    // Any event type the subscribers' update() accepts, passed on by
+    // reference; see observer_ct.h for per-type subscriptions.
+    template <typename Event>
+    static void notify(const Event& event) {
+        (Subs::update(event), ...);
     }
 };
 
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "observer_ct.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+// A vector of trivially copyable values that keeps the first N inline and
+// only allocates once it grows past them. Either way the values are
+// contiguous.
+template <typename T, std::size_t N>
+class small_vector {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    small_vector() = default;
+    small_vector(const small_vector&) = delete;
+    small_vector& operator=(const small_vector&) = delete;
+
+    T* begin() { return data_; }
+    T* end() { return data_ + size_; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+    std::size_t size() const { return size_; }
+
+    void push_back(const T& value) {
+        if(size_ == capacity_) {
+            auto grown = std::make_unique<T[]>(capacity_ * 2);
+            std::copy(begin(), end(), grown.get());
+            heap_ = std::move(grown);
+            data_ = heap_.get();
+            capacity_ *= 2;
+        }
+        data_[size_++] = value;
+    }
+
+    // Order is not kept: the last value takes the erased one's place.
+    void erase_unordered(T* it) {
+        *it = data_[--size_];
+    }
+
+private:
+    T inline_[N];
+    std::unique_ptr<T[]> heap_;
+    T* data_ = inline_;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = N;
+};
+
+// A fixed set of subscribers known at compile time plus plugins attached
+// at runtime. notify() first expands into direct, inlinable update() calls
+// on the static pack, exactly like event_bus, and then walks the dynamic
+// tail: one indirect call per plugin, no virtual dispatch through a base
+// class and no pointer chasing to reach the entries.
+//
+// Plugins are kept as references; attach() and detach() must not race
+// notify().
+template <typename Event, typename... Static>
+class hybrid_publisher {
+public:
+    // Any object with a void update(const Event&) member; a final class is
+    // called without virtual dispatch.
+    template <typename Sub>
+    void attach(Sub& sub) {
+        if(find(&sub) == tail_.end()) {
+            tail_.push_back({&sub, [](void* obj, const Event& event) {
+                                 static_cast<Sub*>(obj)->update(event);
+                             }});
+        }
+    }
+
+    template <typename Sub>
+    void detach(Sub& sub) {
+        if(auto it = find(&sub); it != tail_.end()) {
+            tail_.erase_unordered(it);
+        }
+    }
+
+    std::size_t dynamic_count() const { return tail_.size(); }
+
+    void notify(const Event& event) {
+        if constexpr (event_bus<Static...>::handles::template contains<Event>) {
+            event_bus<Static...>::notify(event);
+        }
+        for(const auto& ref: tail_) {
+            ref.call(ref.obj, event);
+        }
+    }
+
+private:
+    struct function_ref {
+        void* obj;
+        void (*call)(void*, const Event&);
+    };
+
+    function_ref* find(void* obj) {
+        return std::find_if(tail_.begin(), tail_.end(),
+                            [&](const function_ref& ref) { return ref.obj == obj; });
+    }
+
+    small_vector<function_ref, 8> tail_;
+};
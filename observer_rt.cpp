@@ -1,13 +1,12 @@
+#include "observer_rt.h"
+
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
-#include <functional>
+#include <span>
+#include <thread>
 #include <vector>
 
-class subscriber {
-public:
-    virtual void update(float) = 0;
-};
-
 class display : public subscriber {
 public:
     void update(float temp) override {
@@ -29,25 +28,29 @@ public:
     }
 };
 
-class publisher {
+class counter : public subscriber {
 public:
-    void register_sub(subscriber * sub) {
-        if(std::find(subs_.begin(), subs_.end(), sub) == subs_.end()) {
-            subs_.push_back(sub);
-        }
+    void update(float) override {
+        count_.fetch_add(1, std::memory_order_relaxed);
     }
-    void unregister(subscriber * sub) {
-        if(auto it = std::find(subs_.begin(), subs_.end(), sub); it != subs_.end()) {
-            subs_.erase(it);
-        }
-    }
-    void notify(float value) {
-        for(auto sub: subs_) {
-            sub->update(value);
-        }
+    std::uint64_t count() const { return count_.load(); }
+private:
+    std::atomic<std::uint64_t> count_{0};
+};
+
+// Sums each batch it is handed instead of handling values one by one.
+class batch_logger : public subscriber {
+public:
+    void update(float temp) override { update_batch({&temp, 1}); }
+    void update_batch(std::span<const float> temps) override {
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        values_.fetch_add(temps.size(), std::memory_order_relaxed);
     }
+    std::uint64_t batches() const { return batches_.load(); }
+    std::uint64_t values() const { return values_.load(); }
 private:
-    std::vector<subscriber*, 8> subs_;
+    std::atomic<std::uint64_t> batches_{0};
+    std::atomic<std::uint64_t> values_{0};
 };
 
 int main()
@@ -62,6 +65,51 @@ int main()
     temp_publisher.unregister(&temp_logger);
     temp_publisher.register_sub(&temp_data_sender);
     temp_publisher.notify(44.02f);
+    temp_publisher.unregister(&temp_display);
+    temp_publisher.unregister(&temp_data_sender);
+
+    // Sensor threads notify flat out while the main thread keeps adding and
+    // removing a second subscriber.
+    counter always;
+    temp_publisher.register_sub(&always);
+    std::atomic<bool> running{true};
+    std::vector<std::thread> sensors;
+    for(int i = 0; i < 4; ++i) {
+        sensors.emplace_back([&] {
+            while(running.load(std::memory_order_relaxed)) {
+                temp_publisher.notify(21.5f);
+            }
+        });
+    }
+    std::uint64_t seen = 0;
+    for(int i = 0; i < 200; ++i) {
+        counter sometimes;
+        temp_publisher.register_sub(&sometimes);
+        std::this_thread::yield();
+        temp_publisher.unregister(&sometimes);
+        seen += sometimes.count();
+    }
+    running = false;
+    for(auto& sensor: sensors) {
+        sensor.join();
+    }
+    printf("Notifications: %llu, to short-lived subscribers: %llu \r\n",
+           static_cast<unsigned long long>(always.count()),
+           static_cast<unsigned long long>(seen));
+    temp_publisher.unregister(&always);
+
+    // Asynchronous delivery: notify() only writes into the subscriber's ring
+    // and its own thread hands the values over in batches.
+    batch_logger batched;
+    temp_publisher.register_async(&batched, {.capacity = 1024,
+                                             .policy = backpressure::block});
+    for(int i = 0; i < 100000; ++i) {
+        temp_publisher.notify(static_cast<float>(i));
+    }
+    temp_publisher.unregister(&batched);
+    printf("Async values: %llu in %llu batches \r\n",
+           static_cast<unsigned long long>(batched.values()),
+           static_cast<unsigned long long>(batched.batches()));
     while(true)
     {
     }
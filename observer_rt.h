@@ -0,0 +1,475 @@
+#pragma once
+
+#include "rcu.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+class subscriber {
+public:
+    virtual ~subscriber() = default;
+    virtual void update(float) = 0;
+    // Called by notify_block() and by asynchronous delivery with several
+    // values at once, oldest first. Override it to handle a batch at once.
+    virtual void update_batch(std::span<const float> values) {
+        for(auto value: values) {
+            update(value);
+        }
+    }
+};
+
+// What notify() does when an asynchronous subscriber's ring is full.
+enum class backpressure {
+    // Overwrite the oldest queued value; notify() never waits for the
+    // subscriber.
+    drop_oldest,
+    // Wait until the subscriber has made room.
+    block,
+    // Keep only the newest of the values that did not fit; notify() never
+    // waits for the subscriber, which still sees the latest reading.
+    coalesce_latest
+};
+
+struct delivery_options {
+    std::size_t capacity = 4096;
+    backpressure policy = backpressure::drop_oldest;
+    // Most values handed to one update_batch() call.
+    std::size_t max_batch = 256;
+};
+
+// Lets the threads notify()ing a single-producer ring take turns on it.
+// Held for a handful of stores, so waiters spin (yielding) rather than
+// sleep.
+class producer_lock {
+public:
+    void lock() {
+        while(held_.exchange(true, std::memory_order_acquire)) {
+            while(held_.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    void unlock() { held_.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> held_{false};
+};
+
+// Single-consumer ring of floats with one producer at a time (async_channel
+// serializes its producers). The producer may also overwrite unread values;
+// the consumer notices and skips them.
+class spsc_ring {
+public:
+    explicit spsc_ring(std::size_t capacity)
+        : mask_{std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1},
+          slots_(mask_ + 1) {}
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    bool try_push(float value) {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if(head - tail_cache_ > mask_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if(head - tail_cache_ > mask_) {
+                return false;
+            }
+        }
+        publish(head, value);
+        return true;
+    }
+
+    // Always succeeds. If the ring is full the oldest value is lost.
+    void overwrite(float value) {
+        const auto head = head_.load(std::memory_order_relaxed);
+        // Seqlock-style: announce the slot before writing it, so a consumer
+        // that read it while it changed can tell.
+        claimed_.store(head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        publish(head, value);
+    }
+
+    // Copies up to out.size() values, oldest first. Values overwritten
+    // before they could be read are skipped and added to `lost`.
+    std::size_t pop(std::span<float> out, std::uint64_t& lost) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        const auto head = head_.load(std::memory_order_acquire);
+        if(head - tail > capacity()) {
+            lost += head - tail - capacity();
+            tail = head - capacity();
+        }
+        auto count = std::min<std::uint64_t>(head - tail, out.size());
+        for(std::uint64_t i = 0; i < count; ++i) {
+            out[i] = slots_[(tail + i) & mask_].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto claimed = claimed_.load(std::memory_order_relaxed);
+        if(claimed > tail + capacity()) {
+            // The first `stale` values may have changed under us.
+            const auto stale =
+                std::min<std::uint64_t>(claimed - capacity() - tail, count);
+            std::memmove(out.data(), out.data() + stale,
+                         (count - stale) * sizeof(float));
+            lost += stale;
+            tail += stale;
+            count -= stale;
+        }
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) ==
+               tail_.load(std::memory_order_relaxed);
+    }
+
+    // Sequentially consistent, so a consumer about to park and a producer
+    // checking whether it parked cannot miss each other.
+    std::uint64_t head() const { return head_.load(); }
+
+private:
+    void publish(std::uint64_t head, float value) {
+        slots_[head & mask_].store(value, std::memory_order_relaxed);
+        head_.store(head + 1);
+    }
+
+    const std::uint64_t mask_;
+    std::vector<std::atomic<float>> slots_;
+    // Producer side.
+    alignas(64) std::atomic<std::uint64_t> head_{0};
+    std::atomic<std::uint64_t> claimed_{0};
+    std::uint64_t tail_cache_ = 0;
+    // Consumer side.
+    alignas(64) std::atomic<std::uint64_t> tail_{0};
+};
+
+// Delivers one subscriber's values on its own thread, so a slow subscriber
+// only ever delays itself.
+class async_channel {
+public:
+    async_channel(subscriber* sub, const delivery_options& options)
+        : sub_{sub},
+          policy_{options.policy},
+          max_batch_{std::max<std::size_t>(options.max_batch, 1)},
+          ring_{options.capacity},
+          thread_{[this] { run(); }} {}
+
+    // Delivers what is still queued, then joins the delivery thread.
+    ~async_channel() {
+        stopping_.store(true);
+        wake();
+        thread_.join();
+    }
+
+    async_channel(const async_channel&) = delete;
+    async_channel& operator=(const async_channel&) = delete;
+
+    subscriber* sub() const { return sub_; }
+    std::uint64_t lost() const { return lost_.load(); }
+
+    bool on_delivery_thread() const {
+        return std::this_thread::get_id() == thread_.get_id();
+    }
+
+    // Called from the delivery thread: ends delivery once the current
+    // update_batch() returns and drops whatever is still queued. Producers
+    // waiting for room give up, since none will be made.
+    void stop_delivery() {
+        discarding_ = true;
+        closed_.store(true);
+    }
+
+    // Producer side, from any number of threads. They take turns on the
+    // ring, each for as long as it takes to copy its values in (and, under
+    // backpressure::block, to wait for room).
+    void push(float value) {
+        {
+            std::lock_guard<producer_lock> lock{producers_};
+            enqueue(value);
+        }
+        wake_if_sleeping();
+    }
+
+    // The block stays contiguous in the ring.
+    void push_block(std::span<const float> values) {
+        {
+            std::lock_guard<producer_lock> lock{producers_};
+            for(auto value: values) {
+                enqueue(value);
+            }
+        }
+        wake_if_sleeping();
+    }
+
+private:
+    static constexpr std::uint64_t kLatestFlag = std::uint64_t{1} << 32;
+    static constexpr int kSpins = 64;
+
+    void enqueue(float value) {
+        switch(policy_) {
+        case backpressure::drop_oldest:
+            ring_.overwrite(value);
+            break;
+        case backpressure::block:
+            while(!ring_.try_push(value)) {
+                if(closed_.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                // The consumer may have parked before this block started.
+                wake_if_sleeping();
+                std::this_thread::yield();
+            }
+            break;
+        case backpressure::coalesce_latest:
+            // Once a value waits beside the ring, newer ones must join it
+            // rather than overtake it through the ring.
+            if(latest_.load(std::memory_order_acquire) != 0 ||
+               !ring_.try_push(value)) {
+                latest_.store(kLatestFlag | std::bit_cast<std::uint32_t>(value));
+            }
+            break;
+        }
+    }
+
+    void wake_if_sleeping() {
+        if(sleeping_.load()) {
+            wake();
+        }
+    }
+
+    void run() {
+        std::vector<float> batch(max_batch_);
+        std::uint64_t lost = 0;
+        int idle = 0;
+        for(;;) {
+            const auto seen = ring_.head();
+            auto count = ring_.pop(batch, lost);
+            if(count == 0) {
+                if(const auto latest = latest_.exchange(0); latest != 0) {
+                    batch[0] = std::bit_cast<float>(
+                        static_cast<std::uint32_t>(latest));
+                    count = 1;
+                }
+            }
+            lost_.store(lost, std::memory_order_relaxed);
+            if(count != 0) {
+                sub_->update_batch({batch.data(), count});
+                if(discarding_) {
+                    return;
+                }
+                idle = 0;
+                continue;
+            }
+            if(stopping_.load() && ring_.empty() && latest_.load() == 0) {
+                return;
+            }
+            if(++idle < kSpins) {
+                std::this_thread::yield();
+            } else {
+                park(seen);
+            }
+        }
+    }
+
+    // Announces the sleep before re-checking, and push() publishes before
+    // checking the announcement, so one of the two always sees the other.
+    void park(std::uint64_t seen) {
+        const auto signal = signal_.load();
+        sleeping_.store(true);
+        if(ring_.head() == seen && latest_.load() == 0 && !stopping_.load()) {
+            signal_.wait(signal);
+        }
+        sleeping_.store(false);
+    }
+
+    void wake() {
+        signal_.fetch_add(1);
+        signal_.notify_one();
+    }
+
+    subscriber* sub_;
+    backpressure policy_;
+    std::size_t max_batch_;
+    spsc_ring ring_;
+    // Overflow slot for coalesce_latest: flag bit plus the float's bits.
+    std::atomic<std::uint64_t> latest_{0};
+    std::atomic<std::uint64_t> lost_{0};
+    std::atomic<bool> stopping_{false};
+    // Set by stop_delivery(): nothing will read the ring any more.
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> sleeping_{false};
+    std::atomic<std::uint32_t> signal_{0};
+    producer_lock producers_;
+    // Only touched by the delivery thread.
+    bool discarding_ = false;
+    std::thread thread_;
+};
+
+// Safe to use from any number of threads. notify() takes no lock on the
+// subscriber list: it reads the current one inside an RCU read section,
+// while register_sub/unregister publish a modified copy.
+//
+// Subscribers registered with register_async() get their values through a
+// ring and a delivery thread of their own. Concurrent notify() calls take
+// turns on each such ring for the few stores it takes to enqueue.
+class publisher {
+public:
+    ~publisher() {
+        std::vector<std::unique_ptr<async_channel>> channels;
+        {
+            std::lock_guard<std::mutex> lock{channels_mutex_};
+            channels.swap(channels_);
+            std::move(retired_.begin(), retired_.end(), std::back_inserter(channels));
+            retired_.clear();
+        }
+    }
+
+    void register_sub(subscriber * sub) { add({sub, nullptr}); }
+
+    void register_async(subscriber * sub, const delivery_options& options = {}) {
+        reap();
+        std::lock_guard<std::mutex> lock{channels_mutex_};
+        auto channel = std::make_unique<async_channel>(sub, options);
+        if(add({sub, channel.get()})) {
+            channels_.push_back(std::move(channel));
+        }
+    }
+
+    // Once this returns no notify() can still reach sub, so it may be
+    // destroyed, and an asynchronous subscriber has first received what is
+    // still queued.
+    //
+    // Called from inside notify() (from a synchronous subscriber's update())
+    // or from a delivery thread, it cannot wait for the notify() calls under
+    // way: one of them may be waiting for this very thread. It returns at
+    // once instead, and sub may still receive values until a later
+    // register_async() or unregister() from another context, or the
+    // publisher's destructor, frees its channel. The exception is an
+    // asynchronous subscriber unregistering itself from its own
+    // update_batch(): that call is its last and the rest is dropped.
+    void unregister(subscriber * sub) {
+        const auto removed = subs_.update([&](std::vector<entry>& subs) {
+            auto it = std::find_if(subs.begin(), subs.end(),
+                                   [&](const entry& e) { return e.sub == sub; });
+            if(it == subs.end()) {
+                return false;
+            }
+            subs.erase(it);
+            return true;
+        });
+        if(!removed) {
+            return;
+        }
+        // Destroyed after the lock is released, since a delivery thread
+        // being joined may itself be waiting to register or unregister.
+        std::vector<std::unique_ptr<async_channel>> doomed;
+        {
+            std::lock_guard<std::mutex> lock{channels_mutex_};
+            const bool wait = may_wait();
+            if(wait) {
+                doomed.swap(retired_);
+            }
+            const auto it = std::find_if(channels_.begin(), channels_.end(),
+                                         [&](const auto& channel) {
+                                             return channel->sub() == sub;
+                                         });
+            if(it != channels_.end()) {
+                if((*it)->on_delivery_thread()) {
+                    (*it)->stop_delivery();
+                }
+                (wait ? doomed : retired_).push_back(std::move(*it));
+                channels_.erase(it);
+            }
+            if(!wait) {
+                return;
+            }
+        }
+        subs_.synchronize();
+    }
+
+    void notify(float value) {
+        const auto subs = subs_.read();
+        for(const auto& e: *subs) {
+            if(e.channel) {
+                e.channel->push(value);
+            } else {
+                e.sub->update(value);
+            }
+        }
+    }
+
+    // Same as calling notify() for each sample in turn, but a synchronous
+    // subscriber gets the whole block in one update_batch() call.
+    void notify_block(const float* samples, std::size_t count) {
+        const std::span<const float> block{samples, count};
+        const auto subs = subs_.read();
+        for(const auto& e: *subs) {
+            if(e.channel) {
+                e.channel->push_block(block);
+            } else {
+                e.sub->update_batch(block);
+            }
+        }
+    }
+
+private:
+    struct entry {
+        subscriber* sub;
+        async_channel* channel;
+    };
+
+    bool add(entry added) {
+        return subs_.update([&](std::vector<entry>& subs) {
+            for(const auto& e: subs) {
+                if(e.sub == added.sub) {
+                    return false;
+                }
+            }
+            subs.push_back(added);
+            return true;
+        });
+    }
+
+    // Whether the calling thread may wait for the notify() calls under way
+    // and join delivery threads. Called with channels_mutex_ held.
+    bool may_wait() const {
+        if(rcu_domain::instance().in_read_section()) {
+            return false;
+        }
+        const auto delivering = [](const auto& channel) {
+            return channel->on_delivery_thread();
+        };
+        return std::none_of(channels_.begin(), channels_.end(), delivering) &&
+               std::none_of(retired_.begin(), retired_.end(), delivering);
+    }
+
+    // Frees the retired channels once no notify() can still be using them,
+    // if the calling thread may wait for that.
+    void reap() {
+        std::vector<std::unique_ptr<async_channel>> doomed;
+        {
+            std::lock_guard<std::mutex> lock{channels_mutex_};
+            if(retired_.empty() || !may_wait()) {
+                return;
+            }
+            doomed.swap(retired_);
+        }
+        subs_.synchronize();
+    }
+
+    rcu_ptr<std::vector<entry>> subs_;
+    std::mutex channels_mutex_;
+    std::vector<std::unique_ptr<async_channel>> channels_;
+    // Channels unregistered where they could not be freed at once. Still
+    // reachable from notify() calls that had started by then.
+    std::vector<std::unique_ptr<async_channel>> retired_;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "observer_rt.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Broadcast of published values to subscribers in other processes on the
+// same host, through a POSIX shared-memory ring.
+//
+// The publishing process registers an shm_writer like any other
+// subscriber. Each consuming process opens an shm_reader by the same name
+// and polls it; the values are handed to its subscribers straight out of
+// the mapping, without copying. The writer never waits for readers: it
+// overwrites the oldest values, and a reader that fell a whole ring behind
+// skips ahead and counts what it missed in lost().
+
+// Layout at the start of the mapping; the values follow it.
+struct shm_ring_header {
+    static constexpr std::uint64_t expected_magic = 0x6f62732d72696e67; // "obs-ring"
+
+    std::uint64_t magic;
+    std::uint64_t capacity;
+    std::atomic<std::uint32_t> readers;
+    std::atomic<std::uint32_t> closed;
+    // Number of values published.
+    alignas(64) std::atomic<std::uint64_t> head;
+    // Number of values the writer has started to write; runs ahead of head
+    // while a value is being written.
+    std::atomic<std::uint64_t> claimed;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+              std::atomic<std::uint32_t>::is_always_lock_free,
+              "the ring's atomics must work across processes");
+
+class shm_mapping {
+public:
+    shm_mapping(const std::string& name, bool create, std::size_t capacity)
+        : name_{name}, owner_{create} {
+        const int flags = create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR;
+        fd_ = shm_open(name.c_str(), flags, 0600);
+        if(fd_ < 0) {
+            throw std::system_error{errno, std::generic_category(), "shm_open " + name};
+        }
+        try {
+            if(create) {
+                size_ = sizeof(shm_ring_header) + capacity * sizeof(float);
+                if(ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+                    throw std::system_error{errno, std::generic_category(), "ftruncate"};
+                }
+            } else {
+                struct stat st {};
+                if(fstat(fd_, &st) != 0) {
+                    throw std::system_error{errno, std::generic_category(), "fstat"};
+                }
+                size_ = static_cast<std::size_t>(st.st_size);
+                if(size_ < sizeof(shm_ring_header)) {
+                    throw std::runtime_error{name + " is not an observer ring"};
+                }
+            }
+            base_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if(base_ == MAP_FAILED) {
+                throw std::system_error{errno, std::generic_category(), "mmap"};
+            }
+        } catch(...) {
+            close(fd_);
+            if(create) {
+                shm_unlink(name.c_str());
+            }
+            throw;
+        }
+    }
+
+    ~shm_mapping() {
+        munmap(base_, size_);
+        close(fd_);
+        if(owner_) {
+            shm_unlink(name_.c_str());
+        }
+    }
+
+    shm_mapping(const shm_mapping&) = delete;
+    shm_mapping& operator=(const shm_mapping&) = delete;
+
+    shm_ring_header& header() const { return *static_cast<shm_ring_header*>(base_); }
+    float* values() const {
+        return reinterpret_cast<float*>(static_cast<char*>(base_) + sizeof(shm_ring_header));
+    }
+    std::size_t size() const { return size_; }
+
+private:
+    std::string name_;
+    bool owner_;
+    int fd_ = -1;
+    std::size_t size_ = 0;
+    void* base_ = nullptr;
+};
+
+// Creates the ring and removes it again on destruction. Like an async
+// channel, it may be notified from any number of threads: they take turns
+// on the ring for as long as it takes to copy their values in.
+class shm_writer : public subscriber {
+public:
+    explicit shm_writer(const std::string& name, std::size_t capacity = 1 << 16)
+        : mask_{std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1},
+          map_{name, true, mask_ + 1},
+          ring_{map_.header()},
+          values_{map_.values()} {
+        ring_.capacity = mask_ + 1;
+        ring_.magic = shm_ring_header::expected_magic;
+    }
+
+    // Tells readers that nothing more is coming.
+    ~shm_writer() { ring_.closed.store(1); }
+
+    std::uint32_t readers() const { return ring_.readers.load(); }
+
+    void update(float value) override { update_batch({&value, 1}); }
+
+    void update_batch(std::span<const float> values) override {
+        // Only the newest capacity values could ever be read.
+        if(values.size() > mask_ + 1) {
+            values = values.last(mask_ + 1);
+        }
+        std::lock_guard<producer_lock> lock{producers_};
+        auto head = ring_.head.load(std::memory_order_relaxed);
+        const auto end = head + values.size();
+        ring_.claimed.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        while(!values.empty()) {
+            const auto slot = head & mask_;
+            const auto run = std::min<std::size_t>(values.size(), mask_ + 1 - slot);
+            std::memcpy(values_ + slot, values.data(), run * sizeof(float));
+            values = values.subspan(run);
+            head += run;
+        }
+        ring_.head.store(end, std::memory_order_release);
+    }
+
+private:
+    std::uint64_t mask_;
+    shm_mapping map_;
+    shm_ring_header& ring_;
+    float* values_;
+    // In this process only: there is one writing process.
+    producer_lock producers_;
+};
+
+// One consuming process's view of a ring. Starts with the next value
+// published after it opened.
+class shm_reader {
+public:
+    explicit shm_reader(const std::string& name)
+        : map_{name, false, 0}, ring_{map_.header()}, values_{map_.values()} {
+        // The header is written by another process: read the capacity once
+        // and bound it by the mapping before multiplying.
+        const std::uint64_t capacity = ring_.capacity;
+        const auto room = (map_.size() - sizeof(shm_ring_header)) / sizeof(float);
+        if(ring_.magic != shm_ring_header::expected_magic || !std::has_single_bit(capacity) ||
+           capacity > room ||
+           map_.size() != sizeof(shm_ring_header) + capacity * sizeof(float)) {
+            throw std::runtime_error{name + " is not an observer ring"};
+        }
+        mask_ = capacity - 1;
+        tail_ = ring_.head.load(std::memory_order_acquire);
+        ring_.readers.fetch_add(1);
+    }
+
+    ~shm_reader() { ring_.readers.fetch_sub(1); }
+
+    shm_reader(const shm_reader&) = delete;
+    shm_reader& operator=(const shm_reader&) = delete;
+
+    // Hands every value published since the last call to sub, as at most
+    // two update_batch() calls on spans into the shared mapping. Returns
+    // how many values were handed over.
+    //
+    // Values the writer overwrote while sub was reading them are still
+    // handed over but counted in overwritten(): sub may have seen a newer
+    // value in their place.
+    std::size_t poll(subscriber& sub) {
+        const auto head = ring_.head.load(std::memory_order_acquire);
+        const auto capacity = mask_ + 1;
+        if(head - tail_ > capacity) {
+            lost_ += head - tail_ - capacity;
+            tail_ = head - capacity;
+        }
+        std::size_t handed = 0;
+        while(tail_ != head) {
+            const auto slot = tail_ & mask_;
+            const auto run = std::min<std::uint64_t>(head - tail_, capacity - slot);
+            sub.update_batch({values_ + slot, static_cast<std::size_t>(run)});
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const auto claimed = ring_.claimed.load(std::memory_order_relaxed);
+            if(claimed > tail_ + capacity) {
+                overwritten_ += std::min<std::uint64_t>(claimed - capacity - tail_, run);
+            }
+            tail_ += run;
+            handed += run;
+        }
+        return handed;
+    }
+
+    // True once the writer is gone and everything it published was polled.
+    bool finished() const {
+        return ring_.closed.load() != 0 &&
+               ring_.head.load(std::memory_order_acquire) == tail_;
+    }
+
+    // Values skipped because the reader fell a whole ring behind.
+    std::uint64_t lost() const { return lost_; }
+    std::uint64_t overwritten() const { return overwritten_; }
+
+private:
+    shm_mapping map_;
+    shm_ring_header& ring_;
+    float* values_;
+    std::uint64_t mask_ = 0;
+    std::uint64_t tail_ = 0;
+    std::uint64_t lost_ = 0;
+    std::uint64_t overwritten_ = 0;
+};
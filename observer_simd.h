@@ -0,0 +1,171 @@
+#pragma once
+
+#include "observer_rt.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+// Built-in subscribers for blocks of samples. Each one handles a whole
+// notify_block() in a single pass, using std::experimental::simd where the
+// standard library has it and plain loops otherwise (or when
+// OBSERVER_SCALAR is defined). Like the other subscribers they are not
+// synchronized: notify them from one thread at a time.
+#if __has_include(<experimental/simd>) && !defined(OBSERVER_SCALAR)
+#include <experimental/simd>
+#define OBSERVER_SIMD 1
+using simd_float = std::experimental::native_simd<float>;
+#endif
+
+struct block_summary {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    double sum = 0.0;
+    std::uint64_t above = 0;
+};
+
+// Min, max and sum of the block, plus how many samples exceed `limit`.
+inline block_summary summarize(std::span<const float> block,
+                               float limit = std::numeric_limits<float>::infinity()) {
+    block_summary s;
+    std::size_t i = 0;
+#ifdef OBSERVER_SIMD
+    constexpr auto width = simd_float::size();
+    if(block.size() >= width) {
+        simd_float lo{s.min};
+        simd_float hi{s.max};
+        simd_float sum{0.0f};
+        const simd_float threshold{limit};
+        std::size_t above = 0;
+        for(; i + width <= block.size(); i += width) {
+            const simd_float x{block.data() + i, std::experimental::element_aligned};
+            lo = std::experimental::min(lo, x);
+            hi = std::experimental::max(hi, x);
+            sum += x;
+            above += std::experimental::popcount(x > threshold);
+        }
+        s.min = std::experimental::hmin(lo);
+        s.max = std::experimental::hmax(hi);
+        s.sum = std::experimental::reduce(sum);
+        s.above = above;
+    }
+#endif
+    for(; i < block.size(); ++i) {
+        const auto x = block[i];
+        s.min = std::min(s.min, x);
+        s.max = std::max(s.max, x);
+        s.sum += x;
+        s.above += x > limit;
+    }
+    return s;
+}
+
+inline float block_sum(std::span<const float> block) {
+    std::size_t i = 0;
+    float total = 0.0f;
+#ifdef OBSERVER_SIMD
+    constexpr auto width = simd_float::size();
+    if(block.size() >= width) {
+        simd_float sum{0.0f};
+        for(; i + width <= block.size(); i += width) {
+            sum += simd_float{block.data() + i, std::experimental::element_aligned};
+        }
+        total = std::experimental::reduce(sum);
+    }
+#endif
+    for(; i < block.size(); ++i) {
+        total += block[i];
+    }
+    return total;
+}
+
+// Count, min, max and mean of everything seen so far.
+class running_stats : public subscriber {
+public:
+    void update(float value) override { update_batch({&value, 1}); }
+    void update_batch(std::span<const float> values) override {
+        const auto s = summarize(values);
+        count_ += values.size();
+        min_ = std::min(min_, s.min);
+        max_ = std::max(max_, s.max);
+        sum_ += s.sum;
+    }
+
+    std::uint64_t count() const { return count_; }
+    float min() const { return min_; }
+    float max() const { return max_; }
+    double mean() const { return count_ ? sum_ / count_ : 0.0; }
+
+private:
+    std::uint64_t count_ = 0;
+    float min_ = std::numeric_limits<float>::infinity();
+    float max_ = -std::numeric_limits<float>::infinity();
+    double sum_ = 0.0;
+};
+
+// Counts samples above a limit and remembers the highest one.
+class threshold_alarm : public subscriber {
+public:
+    explicit threshold_alarm(float limit) : limit_{limit} {}
+
+    void update(float value) override { update_batch({&value, 1}); }
+    void update_batch(std::span<const float> values) override {
+        const auto s = summarize(values, limit_);
+        above_ += s.above;
+        peak_ = std::max(peak_, s.max);
+    }
+
+    bool triggered() const { return above_ != 0; }
+    std::uint64_t above() const { return above_; }
+    float peak() const { return peak_; }
+
+private:
+    float limit_;
+    std::uint64_t above_ = 0;
+    float peak_ = -std::numeric_limits<float>::infinity();
+};
+
+// Averages every `factor` consecutive samples and hands the averages on to
+// another subscriber, one batch per incoming block. A window may span
+// blocks.
+class decimator : public subscriber {
+public:
+    decimator(std::size_t factor, subscriber* downstream)
+        : factor_{std::max<std::size_t>(factor, 1)}, downstream_{downstream} {}
+
+    void update(float value) override { update_batch({&value, 1}); }
+    void update_batch(std::span<const float> values) override {
+        out_.clear();
+        if(fill_ != 0) {
+            const auto take = std::min(factor_ - fill_, values.size());
+            partial_ += block_sum(values.first(take));
+            fill_ += take;
+            values = values.subspan(take);
+            if(fill_ == factor_) {
+                out_.push_back(partial_ / factor_);
+                fill_ = 0;
+                partial_ = 0.0f;
+            }
+        }
+        for(; values.size() >= factor_; values = values.subspan(factor_)) {
+            out_.push_back(block_sum(values.first(factor_)) / factor_);
+        }
+        if(!values.empty()) {
+            partial_ = block_sum(values);
+            fill_ = values.size();
+        }
+        if(!out_.empty()) {
+            downstream_->update_batch(out_);
+        }
+    }
+
+private:
+    std::size_t factor_;
+    subscriber* downstream_;
+    std::vector<float> out_;
+    float partial_ = 0.0f;
+    std::size_t fill_ = 0;
+};
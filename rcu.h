@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Epoch-based read-copy-update.
+//
+// Readers announce the epoch they started in and never lock. Writers copy
+// the current value, publish the copy with one atomic exchange and free the
+// old one only after every reader that might still be looking at it has
+// left. A reader holds one of max_readers slots for the length of its
+// outermost read section, so any number of threads may read, but only that
+// many at once; a thread beyond them waits for a slot to come free.
+class rcu_domain {
+public:
+    static constexpr std::size_t max_readers = 256;
+
+    static rcu_domain& instance() {
+        static rcu_domain domain;
+        return domain;
+    }
+
+    // Read sections nest; only the outermost one takes a slot and announces
+    // an epoch.
+    void enter() {
+        auto& state = reader();
+        if(state.depth++ == 0) {
+            state.slot = claim(state.last);
+            state.slot->epoch.store(epoch_.load(), std::memory_order_seq_cst);
+        }
+    }
+
+    void leave() {
+        auto& state = reader();
+        if(--state.depth == 0) {
+            state.slot->epoch.store(0, std::memory_order_release);
+            state.slot->taken.store(false, std::memory_order_release);
+        }
+    }
+
+    bool in_read_section() { return reader().depth != 0; }
+
+    // Called after publishing a new version. Readers still in the returned
+    // epoch, or an older one, may hold the version that was replaced.
+    std::uint64_t advance() { return epoch_.fetch_add(1); }
+
+    bool quiescent(std::uint64_t retired) const {
+        const auto used = used_slots_.load(std::memory_order_acquire);
+        for(std::size_t i = 0; i < used; ++i) {
+            const auto epoch = slots_[i].epoch.load(std::memory_order_seq_cst);
+            if(epoch != 0 && epoch <= retired) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void wait_for(std::uint64_t retired) const {
+        while(!quiescent(retired)) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    struct alignas(64) slot {
+        std::atomic<std::uint64_t> epoch{0};
+        std::atomic<bool> taken{false};
+    };
+
+    struct reader_state {
+        // Held while depth is non-zero.
+        struct slot* slot = nullptr;
+        unsigned depth = 0;
+        // The slot this thread had last, tried first so that a thread keeps
+        // to one cache line while there is no contention.
+        std::size_t last = 0;
+    };
+
+    rcu_domain() = default;
+
+    static reader_state& reader() {
+        thread_local reader_state state;
+        return state;
+    }
+
+    slot* claim(std::size_t& last) {
+        for(;;) {
+            for(std::size_t n = 0; n < max_readers; ++n) {
+                const auto i = (last + n) % max_readers;
+                bool expected = false;
+                if(slots_[i].taken.compare_exchange_strong(expected, true)) {
+                    auto used = used_slots_.load();
+                    while(used <= i &&
+                          !used_slots_.compare_exchange_weak(used, i + 1)) {
+                    }
+                    last = i;
+                    return &slots_[i];
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // Starts at 1 so that 0 can mean "not reading".
+    std::atomic<std::uint64_t> epoch_{1};
+    std::atomic<std::size_t> used_slots_{0};
+    std::array<slot, max_readers> slots_;
+};
+
+// A T that many threads read without locking while writers replace it
+// copy-on-write. Writers are serialized among themselves.
+template <typename T>
+class rcu_ptr {
+public:
+    // Keeps the version current at construction alive for as long as it
+    // exists, so references it hands out stay valid.
+    class reader {
+    public:
+        explicit reader(const rcu_ptr& ptr) {
+            rcu_domain::instance().enter();
+            value_ = ptr.current_.load(std::memory_order_seq_cst);
+        }
+        ~reader() { rcu_domain::instance().leave(); }
+
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+
+        const T& operator*() const { return *value_; }
+        const T* operator->() const { return value_; }
+
+    private:
+        const T* value_;
+    };
+
+    explicit rcu_ptr(std::unique_ptr<T> initial = std::make_unique<T>())
+        : current_{initial.release()} {}
+
+    // No reader may still be running.
+    ~rcu_ptr() { delete current_.load(); }
+
+    rcu_ptr(const rcu_ptr&) = delete;
+    rcu_ptr& operator=(const rcu_ptr&) = delete;
+
+    reader read() const { return reader{*this}; }
+
+    // Calls mutate(copy) on a copy of the current value and publishes the
+    // copy unless mutate returns false. Never waits for readers.
+    template <typename F>
+    bool update(F&& mutate) {
+        std::lock_guard<std::mutex> lock{write_mutex_};
+        auto next = std::make_unique<T>(*current_.load());
+        if(!mutate(*next)) {
+            return false;
+        }
+        replace(std::move(next));
+        return true;
+    }
+
+    // Publishes a new value without looking at the old one.
+    void store(std::unique_ptr<T> next) {
+        std::lock_guard<std::mutex> lock{write_mutex_};
+        replace(std::move(next));
+    }
+
+    // Returns once no reader can still see a version replaced before the
+    // call, and frees those versions. Calling it from inside a read section
+    // would wait for itself, so it returns right away there instead.
+    void synchronize() {
+        auto& domain = rcu_domain::instance();
+        if(domain.in_read_section()) {
+            return;
+        }
+        domain.wait_for(domain.advance());
+        std::lock_guard<std::mutex> lock{write_mutex_};
+        reclaim();
+    }
+
+private:
+    struct retired {
+        std::uint64_t epoch;
+        std::unique_ptr<T> value;
+    };
+
+    void replace(std::unique_ptr<T> next) {
+        std::unique_ptr<T> old{current_.exchange(next.release())};
+        retired_.push_back({rcu_domain::instance().advance(), std::move(old)});
+        reclaim();
+    }
+
+    void reclaim() {
+        auto& domain = rcu_domain::instance();
+        retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+                                      [&](const retired& entry) {
+                                          return domain.quiescent(entry.epoch);
+                                      }),
+                       retired_.end());
+    }
+
+    std::atomic<T*> current_;
+    std::mutex write_mutex_;
+    std::vector<retired> retired_;
+};
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Hierarchical timing wheel: four levels of 256 slots, each level's slot
+// spanning 256 of the level below. Scheduling and cancelling are O(1);
+// timers are cascaded to a finer level at most three times on their way
+// to expiry. Delays are in ticks and capped at 2^32 - 1.
+//
+// With clock_mode::manual time only moves through advance(), so a test can
+// step through expiries deterministically. With clock_mode::steady, poll()
+// catches up with std::chrono::steady_clock.
+//
+// Not synchronized; callbacks may schedule and cancel timers.
+class timer_wheel {
+public:
+    enum class clock_mode { steady, manual };
+
+    struct timer_id {
+        std::uint32_t index = std::numeric_limits<std::uint32_t>::max();
+        std::uint32_t generation = 0;
+    };
+
+    static constexpr std::uint64_t max_delay = (std::uint64_t{1} << 32) - 1;
+
+    explicit timer_wheel(std::chrono::nanoseconds tick = std::chrono::milliseconds{1},
+                         clock_mode mode = clock_mode::steady)
+        : tick_{tick}, mode_{mode}, epoch_{std::chrono::steady_clock::now()} {
+        heads_.fill(nil);
+    }
+
+    std::uint64_t now() const { return now_; }
+    std::size_t size() const { return active_; }
+    std::chrono::nanoseconds tick() const { return tick_; }
+
+    // Fires `delay` ticks from now (at least one), passing payload to the
+    // callback given to advance() or poll().
+    timer_id schedule(std::uint64_t delay, std::uint64_t payload) {
+        std::uint32_t index;
+        if(free_ != nil) {
+            index = free_;
+            free_ = nodes_[index].next;
+        } else {
+            index = static_cast<std::uint32_t>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        auto& n = nodes_[index];
+        n.expires = now_ + std::min(std::max<std::uint64_t>(delay, 1), max_delay);
+        n.payload = payload;
+        n.armed = true;
+        link(index);
+        ++active_;
+        return {index, n.generation};
+    }
+
+    // Returns false if the timer already fired or was cancelled.
+    bool cancel(timer_id id) {
+        if(id.index >= nodes_.size()) {
+            return false;
+        }
+        auto& n = nodes_[id.index];
+        if(!n.armed || n.generation != id.generation) {
+            return false;
+        }
+        unlink(id.index);
+        release(id.index);
+        return true;
+    }
+
+    // Moves time forward by `ticks`, calling on_expire(payload) for every
+    // timer that comes due, in expiry order. Returns how many fired. Runs of
+    // ticks in which nothing can happen are skipped in one step.
+    template <typename F>
+    std::size_t advance(std::uint64_t ticks, F&& on_expire) {
+        std::size_t fired = 0;
+        const auto end = now_ + ticks;
+        while(now_ < end) {
+            // With the levels below `level` empty, nothing happens before
+            // that level's next cascade.
+            unsigned level = 0;
+            while(per_level_[level] == 0 && level + 1 < levels) {
+                ++level;
+            }
+            if(per_level_[level] == 0) {
+                now_ = end;
+                break;
+            }
+            if(level > 0) {
+                const auto shift = level * slot_bits;
+                const auto next_cascade = ((now_ >> shift) + 1) << shift;
+                now_ = std::min(end, next_cascade - 1);
+                if(now_ == end) {
+                    break;
+                }
+            }
+            ++now_;
+            cascade();
+            auto& head = heads_[slot(0, now_)];
+            while(head != nil) {
+                const auto index = head;
+                unlink(index);
+                const auto payload = nodes_[index].payload;
+                release(index);
+                ++fired;
+                on_expire(payload);
+            }
+        }
+        return fired;
+    }
+
+    // Advances to the current steady_clock time; a no-op in manual mode.
+    template <typename F>
+    std::size_t poll(F&& on_expire) {
+        if(mode_ == clock_mode::manual) {
+            return 0;
+        }
+        const auto target = static_cast<std::uint64_t>(
+            (std::chrono::steady_clock::now() - epoch_) / tick_);
+        return target > now_ ? advance(target - now_, on_expire) : 0;
+    }
+
+private:
+    static constexpr std::uint32_t nil = std::numeric_limits<std::uint32_t>::max();
+    static constexpr unsigned levels = 4;
+    static constexpr unsigned slot_bits = 8;
+    static constexpr std::uint64_t slots = 1 << slot_bits;
+
+    struct node {
+        std::uint64_t expires = 0;
+        std::uint64_t payload = 0;
+        std::uint32_t prev = nil;
+        std::uint32_t next = nil;
+        std::uint32_t generation = 0;
+        std::uint32_t bucket = nil;
+        bool armed = false;
+    };
+
+    static std::size_t slot(unsigned level, std::uint64_t time) {
+        return level * slots + ((time >> (level * slot_bits)) & (slots - 1));
+    }
+
+    // The coarsest level needed is the one whose slot span still covers
+    // the remaining delay.
+    void link(std::uint32_t index) {
+        auto& n = nodes_[index];
+        const auto delta = n.expires - now_;
+        unsigned level = 0;
+        while(level + 1 < levels && delta >= std::uint64_t{1} << ((level + 1) * slot_bits)) {
+            ++level;
+        }
+        n.bucket = static_cast<std::uint32_t>(slot(level, n.expires));
+        n.prev = nil;
+        n.next = heads_[n.bucket];
+        if(n.next != nil) {
+            nodes_[n.next].prev = index;
+        }
+        heads_[n.bucket] = index;
+        ++per_level_[level];
+    }
+
+    void unlink(std::uint32_t index) {
+        auto& n = nodes_[index];
+        if(n.prev != nil) {
+            nodes_[n.prev].next = n.next;
+        } else {
+            heads_[n.bucket] = n.next;
+        }
+        if(n.next != nil) {
+            nodes_[n.next].prev = n.prev;
+        }
+        --per_level_[n.bucket / slots];
+    }
+
+    void release(std::uint32_t index) {
+        auto& n = nodes_[index];
+        n.armed = false;
+        ++n.generation;
+        n.next = free_;
+        free_ = index;
+        --active_;
+    }
+
+    // Whenever a level wraps, the matching slot one level up now holds
+    // timers due within the next span; spread them over the finer levels.
+    void cascade() {
+        for(unsigned level = 1; level < levels; ++level) {
+            if((now_ & ((std::uint64_t{1} << (level * slot_bits)) - 1)) != 0) {
+                return;
+            }
+            auto& head = heads_[slot(level, now_)];
+            auto index = head;
+            head = nil;
+            while(index != nil) {
+                --per_level_[level];
+                const auto next = nodes_[index].next;
+                link(index);
+                index = next;
+            }
+        }
+    }
+
+    std::chrono::nanoseconds tick_;
+    clock_mode mode_;
+    std::chrono::steady_clock::time_point epoch_;
+    std::uint64_t now_ = 0;
+    std::size_t active_ = 0;
+    std::vector<node> nodes_;
+    std::uint32_t free_ = nil;
+    std::array<std::uint32_t, levels * slots> heads_;
+    std::array<std::size_t, levels> per_level_{};
+};
+
+// A timeout for each of many Machine instances while it is in State:
+// entering State arms a timer (re-entering it from State starts a fresh
+// one), leaving it cancels the timer, and expiry feeds Event back into that
+// instance's handle_event().
+template <typename Machine, auto State, auto Event>
+class fsm_timeouts {
+public:
+    fsm_timeouts(std::size_t instances, timer_wheel& wheel, std::uint64_t timeout)
+        : machines_(instances), timers_(instances), wheel_{wheel}, timeout_{timeout} {
+        for(std::uint32_t i = 0; i < instances; ++i) {
+            track(i, State == machines_[i].get_state());
+        }
+    }
+
+    Machine& machine(std::uint32_t instance) { return machines_[instance]; }
+    std::size_t size() const { return machines_.size(); }
+
+    bool handle_event(std::uint32_t instance, decltype(Event) event) {
+        auto& m = machines_[instance];
+        const bool was_in = m.get_state() == State;
+        const bool taken = m.handle_event(event);
+        const bool is_in = m.get_state() == State;
+        if((taken && is_in) || was_in != is_in) {
+            track(instance, is_in);
+        }
+        return taken;
+    }
+
+    // Advances the wheel (in manual mode) and delivers the timeouts.
+    std::size_t advance(std::uint64_t ticks) {
+        return wheel_.advance(ticks, [&](std::uint64_t instance) { expire(instance); });
+    }
+
+    std::size_t poll() {
+        return wheel_.poll([&](std::uint64_t instance) { expire(instance); });
+    }
+
+private:
+    void track(std::uint32_t instance, bool in_state) {
+        wheel_.cancel(timers_[instance]);
+        timers_[instance] =
+            in_state ? wheel_.schedule(timeout_, instance) : timer_wheel::timer_id{};
+    }
+
+    void expire(std::uint64_t instance) {
+        const auto i = static_cast<std::uint32_t>(instance);
+        // The timer has fired, so there is nothing left to cancel.
+        timers_[i] = {};
+        handle_event(i, Event);
+    }
+
+    std::vector<Machine> machines_;
+    std::vector<timer_wheel::timer_id> timers_;
+    timer_wheel& wheel_;
+    std::uint64_t timeout_;
+};